@@ -0,0 +1,220 @@
+// Benchmarks for logging calls and sinks.
+//
+// usage: bench_log [--csv | --json] [records [max_threads]]
+//
+// Each benchmark makes `records` logging calls through a facility, split
+// evenly over 1, 2, 4, ... up to `max_threads` threads (by default, the
+// hardware concurrency), and reports the elapsed time, records per second
+// and nanoseconds per record. Sinks write to a temporary file or /dev/null.
+//
+// Output is a table by default, or CSV or JSON (an array of objects) for
+// tracking results between releases.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <log/fd_sink.hpp>
+#include <log/log.hpp>
+#include <log/mmap_sink.hpp>
+
+namespace {
+
+struct temporary_path {
+    std::string path;
+
+    temporary_path() {
+        const char* tmpdir = std::getenv("TMPDIR");
+        std::string tmpl = std::string(tmpdir? tmpdir: "/tmp")+"/bench_log_XXXXXX";
+
+        std::vector<char> buf(tmpl.begin(), tmpl.end());
+        buf.push_back(0);
+        int fd = mkstemp(buf.data());
+        if (fd>=0) close(fd);
+        path = buf.data();
+    }
+
+    ~temporary_path() { unlink(path.c_str()); }
+};
+
+// logging loops: records [begin, end) through facility `f`, which is at
+// level 0.
+
+void log_enabled(log::facility& f, long begin, long end) {
+    for (long i=begin; i<end; ++i) {
+        LOG(f, 0) << "record " << i << " of a benchmark run";
+    }
+}
+
+void log_disabled_by_object(log::facility& f, long begin, long end) {
+    for (long i=begin; i<end; ++i) {
+        LOG(f, 1) << "record " << i << " of a benchmark run";
+    }
+}
+
+// a literal name is looked up in the global manager
+void log_disabled_by_name(log::facility&, long begin, long end) {
+    for (long i=begin; i<end; ++i) {
+        LOG("bench_disabled", 1) << "record " << i << " of a benchmark run";
+    }
+}
+
+using sink_maker = std::function<log::log_sink_t (const std::string&, std::function<void ()>&)>;
+
+struct benchmark {
+    const char* name;
+    void (*body)(log::facility&, long, long);
+
+    // make a sink writing to the given path, and a function to call once
+    // logging is complete.
+    sink_maker make_sink;
+};
+
+struct result {
+    const char* name;
+    unsigned threads;
+    long records;
+    double seconds;
+};
+
+result run(const benchmark& b, long n, unsigned threads) {
+    temporary_path tmp;
+    std::function<void ()> finish = []() {};
+
+    double elapsed;
+    {
+        log::facility_manager mgr(b.make_sink(tmp.path, finish));
+        log::facility bench("bench", mgr);
+
+        std::atomic<bool> go{false};
+        std::vector<std::thread> workers;
+        for (unsigned t=0; t<threads; ++t) {
+            long begin = n*t/threads, end = n*(t+1)/threads;
+            workers.emplace_back([&b, &bench, &go, begin, end]() {
+                while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+                b.body(bench, begin, end);
+            });
+        }
+
+        auto t0 = std::chrono::steady_clock::now();
+        go.store(true, std::memory_order_release);
+        for (auto& w: workers) w.join();
+        finish();
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+    }
+    return result{b.name, threads, n, elapsed};
+}
+
+log::log_sink_t null_sink(const std::string&, std::function<void ()>&) {
+    return [](const log::log_entry&) {};
+}
+
+sink_maker dev_null_sink(log::flag flush) {
+    return [flush](const std::string&, std::function<void ()>& finish) -> log::log_sink_t {
+        auto out = std::make_shared<std::ofstream>("/dev/null");
+        log::stream_sink sink(*out, flush, log::flag::noemitloc);
+        finish = [out]() { out->flush(); };
+        return sink;
+    };
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv) {
+    using log::flag;
+
+    enum { table, csv, json } format = table;
+    int arg = 1;
+    if (arg<argc && !std::strcmp(argv[arg], "--csv")) {
+        format = csv;
+        ++arg;
+    }
+    else if (arg<argc && !std::strcmp(argv[arg], "--json")) {
+        format = json;
+        ++arg;
+    }
+
+    long n = arg<argc? std::atol(argv[arg++]): 1000000;
+    unsigned max_threads = arg<argc? std::atoi(argv[arg++]): std::thread::hardware_concurrency();
+    max_threads = std::max(max_threads, 1u);
+
+    log::level("bench_disabled", 0);
+
+    std::vector<benchmark> benchmarks = {
+        {"LOG disabled by name", log_disabled_by_name, null_sink},
+        {"LOG disabled by object", log_disabled_by_object, null_sink},
+        {"LOG null sink", log_enabled, null_sink},
+        {"stream_sink /dev/null flush", log_enabled, dev_null_sink(flag::flush)},
+        {"stream_sink /dev/null noflush", log_enabled, dev_null_sink(flag::noflush)},
+        {"file_sink flush", log_enabled, [](const std::string& p, std::function<void ()>&) -> log::log_sink_t {
+            return log::file_sink(p, flag::flush, flag::noemitloc);
+        }},
+        {"file_sink noflush", log_enabled, [](const std::string& p, std::function<void ()>&) -> log::log_sink_t {
+            return log::file_sink(p, flag::noflush, flag::noemitloc);
+        }},
+        {"fd_sink flush", log_enabled, [](const std::string& p, std::function<void ()>&) -> log::log_sink_t {
+            return log::fd_sink(p, flag::flush, flag::noemitloc);
+        }},
+        {"fd_sink noflush", log_enabled, [](const std::string& p, std::function<void ()>& finish) -> log::log_sink_t {
+            log::fd_sink sink(p, flag::noflush, flag::noemitloc);
+            finish = [sink]() mutable { sink.flush(); };
+            return sink;
+        }},
+        {"mmap_sink", log_enabled, [](const std::string& p, std::function<void ()>&) -> log::log_sink_t {
+            return log::mmap_sink(p, flag::noemitloc);
+        }},
+    };
+
+    std::vector<unsigned> thread_counts;
+    for (unsigned t=1; t<max_threads; t *= 2) thread_counts.push_back(t);
+    thread_counts.push_back(max_threads);
+
+    switch (format) {
+    case table:
+        std::printf("%-32s %7s %14s %10s\n", "benchmark", "threads", "records/s", "ns/record");
+        break;
+    case csv:
+        std::printf("benchmark,threads,records,seconds,records_per_second,ns_per_record\n");
+        break;
+    case json:
+        std::printf("[");
+        break;
+    }
+
+    bool first = true;
+    for (auto& b: benchmarks) {
+        for (unsigned t: thread_counts) {
+            result r = run(b, n, t);
+            double rate = r.records/r.seconds;
+            double ns = 1e9*r.seconds/r.records;
+
+            switch (format) {
+            case table:
+                std::printf("%-32s %7u %14.0f %10.1f\n", r.name, r.threads, rate, ns);
+                break;
+            case csv:
+                std::printf("\"%s\",%u,%ld,%.6f,%.0f,%.2f\n", r.name, r.threads, r.records, r.seconds, rate, ns);
+                break;
+            case json:
+                std::printf("%s\n  {\"benchmark\": \"%s\", \"threads\": %u, \"records\": %ld, \"seconds\": %.6f, "
+                    "\"records_per_second\": %.0f, \"ns_per_record\": %.2f}",
+                    first? "": ",", r.name, r.threads, r.records, r.seconds, rate, ns);
+                break;
+            }
+            std::fflush(stdout);
+            first = false;
+        }
+    }
+    if (format==json) std::printf("\n]\n");
+}
@@ -0,0 +1,74 @@
+#include <algorithm>
+#include <cstdio>
+
+#include <log/async_sink.hpp>
+#include <log/stored_entry.hpp>
+
+namespace log {
+
+constexpr std::size_t async_sink::default_capacity;
+constexpr const char* drop_table::other_name;
+
+async_sink::async_sink(log_batch_sink_t sink, std::size_t capacity, overflow policy,
+    std::chrono::milliseconds report_interval, batch_tag):
+    sink_(std::move(sink))
+{
+    using worker_type = async_worker<stored_entry>;
+    log_batch_sink_t target = sink_;
+
+    worker_type::handlers h;
+    h.deliver_batch = [target](stored_entry* entries, std::size_t n) {
+        if (!target) return;
+
+        log_entry views[worker_type::max_batch];
+        while (n) {
+            std::size_t k = std::min(n, worker_type::max_batch);
+            for (std::size_t i=0; i<k; ++i) views[i] = entries[i].entry();
+            target(views, k);
+
+            entries += k;
+            n -= k;
+        }
+    };
+    h.name = [](const stored_entry& s) {
+        return s.entry().name;
+    };
+    h.report = [target](const char* name, std::uint64_t n) {
+        char msg[64];
+        std::snprintf(msg, sizeof(msg), "%llu records dropped", static_cast<unsigned long long>(n));
+
+        log_entry report{name, 0, no_source_location, msg,
+            read_clock(clock_source::realtime), thread_index(), 0};
+        if (target) target(&report, 1);
+    };
+
+    worker_ = worker_type::start(capacity, policy, report_interval, std::move(h));
+}
+
+void async_sink::operator()(const log_entry& entry) {
+    worker_->submit(entry.name,
+        [&entry](stored_entry& s) { s.assign(entry); },
+        [this, &entry]() { if (sink_) sink_(&entry, 1); });
+}
+
+void async_sink::operator()(const log_entry* entries, std::size_t n) {
+    for (std::size_t i=0; i<n; ++i) (*this)(entries[i]);
+}
+
+void async_sink::flush() {
+    worker_->flush();
+}
+
+void async_sink::shutdown() {
+    worker_->shutdown();
+}
+
+std::uint64_t async_sink::dropped() const {
+    return worker_->dropped();
+}
+
+std::uint64_t async_sink::dropped(const char* name) const {
+    return worker_->dropped(name);
+}
+
+} // namespace log
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include <log/async_worker.hpp>
+#include <log/batch_sink.hpp>
+#include <log/facility.hpp>
+
+namespace log {
+
+class stored_entry;
+
+// `async_sink` hands records to a wrapped sink on a dedicated writer thread.
+//
+// Records are copied into a bounded queue, so that the logging thread does
+// not wait on the wrapped sink; the `overflow` policy determines what
+// happens when the queue is full (`overflow::sync` passes the record to the
+// wrapped sink on the logging thread). Copies of an `async_sink` share the
+// queue and writer thread, which is stopped when the last copy is destroyed.
+//
+// Records discarded under the `drop` and `overwrite` policies are counted per
+// facility. The writer thread periodically reports them to the wrapped sink
+// with a synthetic "N records dropped" record under the facility's name.
+//
+// The wrapped sink is called by one thread at a time, whether from the
+// writer or from a logging thread (see `async_worker`).
+//
+// Records logged from the writer thread itself (e.g. by the wrapped sink),
+// or after `shutdown()`, are passed to the wrapped sink directly.
+//
+// The writer passes records to a wrapped batch sink as many at a time as
+// it finds queued, up to a limit.
+
+class async_sink {
+public:
+    static constexpr std::size_t default_capacity = 4096;
+
+    // `sink` may be a single-record or a batch sink (see `log_batch_sink_t`);
+    // a batch sink receives up to `async_worker<>::max_batch` records at a time.
+    template <typename Sink, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<Sink>::type, async_sink>::value>::type>
+    explicit async_sink(Sink sink,
+        std::size_t capacity = default_capacity,
+        overflow policy = overflow::block,
+        std::chrono::milliseconds report_interval = std::chrono::seconds(1)):
+        async_sink(as_batch_sink(std::move(sink)), capacity, policy, report_interval, batch_tag{})
+    {}
+
+    void operator()(const log_entry& entry);
+    void operator()(const log_entry* entries, std::size_t n);
+
+    // wait until every record submitted before the call has been passed
+    // to the wrapped sink (or discarded), and report outstanding drops.
+    void flush();
+
+    // deliver outstanding records and stop the writer thread.
+    void shutdown();
+
+    // total number of discarded records
+    std::uint64_t dropped() const;
+
+    // number of discarded records from the named facility
+    std::uint64_t dropped(const char* name) const;
+
+private:
+    struct batch_tag {};
+
+    async_sink(log_batch_sink_t sink, std::size_t capacity, overflow policy,
+        std::chrono::milliseconds report_interval, batch_tag);
+
+    std::shared_ptr<async_worker<stored_entry>> worker_;
+    log_batch_sink_t sink_;
+};
+
+} // namespace log
@@ -0,0 +1,397 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <log/bounded_queue.hpp>
+
+namespace log {
+
+// what an asynchronous writer does with a record when its queue is full
+
+enum class overflow {
+    block,     // wait for space in the queue
+    drop,      // discard the new record
+    overwrite, // discard the oldest queued record
+    sync       // handle the record on the logging thread
+};
+
+// Per-facility drop counts, keyed by facility name. Slots are claimed with
+// a compare-and-swap on the name hash and never released; if the table
+// fills, drops for further facilities are counted together and reported
+// under the name `other_name`.
+
+class drop_table {
+public:
+    static constexpr std::size_t nslot = 128;
+    static constexpr std::size_t max_name = 64;
+    static constexpr const char* other_name = "(other facilities)";
+
+    void count(const char* name) {
+        if (!name) name = "";
+        if (slot* s = find(name, true)) {
+            s->total.fetch_add(1, std::memory_order_relaxed);
+        }
+        total_.fetch_add(1, std::memory_order_relaxed);
+        pending_.store(true, std::memory_order_release);
+    }
+
+    std::uint64_t dropped() const { return total_.load(std::memory_order_relaxed); }
+
+    std::uint64_t dropped(const char* name) const {
+        if (!name) name = "";
+        const slot* s = const_cast<drop_table*>(this)->find(name, false);
+        if (!s && !std::strcmp(name, other_name)) s = &other_;
+        return s? s->total.load(std::memory_order_relaxed): 0;
+    }
+
+    // call `report(name, n)` for each facility with unreported drops;
+    // only one thread may report at a time.
+    template <typename Report>
+    void report(Report&& report) {
+        if (!pending_.exchange(false, std::memory_order_acquire)) return;
+
+        for (auto& s: slots_) {
+            if (s.ready.load(std::memory_order_acquire)) report_slot(s, s.name, report);
+        }
+        report_slot(other_, other_name, report);
+    }
+
+private:
+    struct slot {
+        std::atomic<std::size_t> hash{0};
+        std::atomic<bool> ready{false};
+        char name[max_name];
+        std::atomic<std::uint64_t> total{0};
+        std::uint64_t reported = 0; // reporting thread only
+    };
+
+    slot slots_[nslot];
+    slot other_;    // facilities without a slot
+    std::atomic<std::uint64_t> total_{0};
+    std::atomic<bool> pending_{false};
+
+    template <typename Report>
+    static void report_slot(slot& s, const char* name, Report& report) {
+        std::uint64_t total = s.total.load(std::memory_order_relaxed);
+        if (total>s.reported) {
+            report(name, total-s.reported);
+            s.reported = total;
+        }
+    }
+
+    static std::size_t hash(const char* name) {
+        std::size_t h = 14695981039346656037ull;
+        while (*name) {
+            h ^= static_cast<unsigned char>(*name++);
+            h *= 1099511628211ull;
+        }
+        return h? h: 1;
+    }
+
+    slot* find(const char* name, bool insert) {
+        std::size_t h = hash(name);
+        for (std::size_t i=0; i<nslot; ++i) {
+            slot& s = slots_[(h+i)%nslot];
+            std::size_t sh = s.hash.load(std::memory_order_acquire);
+
+            if (sh==0) {
+                if (!insert) return nullptr;
+                if (s.hash.compare_exchange_strong(sh, h, std::memory_order_acq_rel)) {
+                    std::snprintf(s.name, max_name, "%s", name);
+                    s.ready.store(true, std::memory_order_release);
+                    return &s;
+                }
+            }
+            if (sh==h) {
+                // slot being claimed by another thread: count against it
+                if (!s.ready.load(std::memory_order_acquire)) return &s;
+                if (!std::strncmp(s.name, name, max_name-1)) return &s;
+            }
+        }
+        return insert? &other_: nullptr;
+    }
+};
+
+// `async_worker` is the machinery behind asynchronous sinks: a bounded queue
+// of `T` filled by logging threads and drained by a dedicated writer thread,
+// with an `overflow` policy for a full queue and per-facility accounting of
+// discarded records.
+//
+// Workers are created with `async_worker<T>::start`; the writer thread is
+// stopped when the last copy of the returned pointer is dropped.
+//
+// Handlers are called by one thread at a time: elements handled and drops
+// reported on a logging thread (under `overflow::sync`, or by `flush`) wait
+// for the writer to finish its current batch, so that a wrapped sink need
+// not be thread-safe.
+
+template <typename T>
+class async_worker {
+public:
+    struct handlers {
+        std::function<void (T&)> deliver;                      // handle a queued element
+        std::function<void (T*, std::size_t)> deliver_batch;   // if set, handle elements in batches instead
+        std::function<const char* (const T&)> name;            // facility name, for drop accounting
+        std::function<void (const char*, std::uint64_t)> report; // report drops for a facility
+    };
+
+    // maximum number of elements passed to `deliver_batch`
+    static constexpr std::size_t max_batch = 64;
+
+    using clock_type = std::chrono::steady_clock;
+
+    async_worker(std::size_t capacity, overflow policy, clock_type::duration report_interval, handlers h):
+        queue_(capacity), policy_(policy), h_(std::move(h)),
+        report_interval_(report_interval), last_report_(clock_type::now())
+    {}
+
+    static std::shared_ptr<async_worker> start(std::size_t capacity, overflow policy,
+        clock_type::duration report_interval, handlers h)
+    {
+        auto w = std::make_shared<async_worker>(capacity, policy, report_interval, std::move(h));
+
+        // the writer thread shares ownership of the worker, so that it
+        // remains valid even if the last handle is dropped on the writer.
+        w->writer_ = std::thread([w]() { w->run(); });
+
+        return std::shared_ptr<async_worker>(w.get(), [w](async_worker* p) mutable {
+            p->shutdown();
+            w.reset();
+        });
+    }
+
+    bool on_writer() const { return std::this_thread::get_id()==writer_id_.load(std::memory_order_acquire); }
+
+    // queue an element, filled in place by `fill(T&)`; `direct()` is called
+    // instead when the element should be handled on the calling thread.
+    template <typename Fill, typename Direct>
+    void submit(const char* name, Fill&& fill, Direct&& direct) {
+        // (stopped first: the id of the writer may be reused once it exits)
+        if (stopped_.load(std::memory_order_relaxed)) {
+            deliver_stopped(direct);
+            return;
+        }
+        if (on_writer()) {
+            direct();
+            return;
+        }
+
+        while (!queue_.try_push(fill)) {
+            if (stopped_.load()) {
+                deliver_stopped(direct);
+                return;
+            }
+
+            switch (policy_) {
+            case overflow::block:
+                wait_for_writer();
+                break;
+            case overflow::drop:
+                drops_.count(name);
+                return;
+            case overflow::overwrite:
+                // nothing to overwrite if the only unreleased element is
+                // still being filled: discard the new record instead.
+                if (!queue_.try_pop([this](T& x) { discard(x); })) {
+                    drops_.count(name);
+                    return;
+                }
+                break;
+            case overflow::sync:
+                deliver_direct(direct);
+                return;
+            }
+        }
+
+        notify_writer();
+        if (stopped_.load()) drain();
+    }
+
+    // wait until every element queued before the call has been handled or
+    // discarded, and report outstanding drops.
+    void flush() {
+        if (!stopped_.load() && on_writer()) return;
+
+        std::size_t target = queue_.pushed();
+        while (consumed_.load(std::memory_order_acquire)<target) {
+            if (stopped_.load()) {
+                drain();
+                if (queue_.empty()) break;
+            }
+            wait_for_writer();
+        }
+        report_drops();
+    }
+
+    // handle outstanding elements and stop the writer thread.
+    void shutdown() {
+        std::lock_guard<std::mutex> guard(shutdown_mex_);
+        if (!writer_.joinable()) return;
+
+        stopped_.store(true);
+        {
+            lock_type lock(mex_);
+            wake_.notify_one();
+        }
+
+        if (on_writer()) writer_.detach();
+        else writer_.join();
+        drain();
+        report_drops();
+    }
+
+    std::uint64_t dropped() const { return drops_.dropped(); }
+    std::uint64_t dropped(const char* name) const { return drops_.dropped(name); }
+
+private:
+    using lock_type = std::unique_lock<std::mutex>;
+
+    bounded_queue<T> queue_;
+    overflow policy_;
+    handlers h_;
+    drop_table drops_;
+
+    clock_type::duration report_interval_;
+    clock_type::time_point last_report_; // writer only
+
+    std::atomic<bool> stopped_{false};
+    std::atomic<bool> writer_idle_{false};
+    std::atomic<int> waiters_{0};
+    std::atomic<std::size_t> consumed_{0};
+
+    // `mex_` guards only the condition variable waits
+    std::mutex mex_;
+    std::condition_variable wake_;     // writer waiting for elements
+    std::condition_variable progress_; // producers and flushers waiting on writer
+
+    // held while calling handlers; recursive, as a handler may log again
+    // through the worker from a logging thread.
+    std::recursive_mutex deliver_mex_;
+
+    std::mutex shutdown_mex_;
+    std::thread writer_;
+    std::atomic<std::thread::id> writer_id_{}; // set by the writer before it handles anything
+
+    void discard(const T& x) {
+        drops_.count(h_.name(x));
+        consumed_.fetch_add(1, std::memory_order_release);
+    }
+
+    void report_drops() {
+        std::lock_guard<std::recursive_mutex> guard(deliver_mex_);
+        drops_.report(h_.report);
+    }
+
+    template <typename Direct>
+    void deliver_direct(Direct& direct) {
+        if (on_writer()) {
+            direct();
+            return;
+        }
+        std::lock_guard<std::recursive_mutex> guard(deliver_mex_);
+        direct();
+    }
+
+    // after shutdown, elements are handled on the logging thread, after
+    // any still queued, one thread at a time.
+    template <typename Direct>
+    void deliver_stopped(Direct& direct) {
+        std::lock_guard<std::recursive_mutex> guard(deliver_mex_);
+        if (!queue_.empty()) drain();
+        direct();
+    }
+
+    std::vector<T> make_scratch() const {
+        return std::vector<T>(h_.deliver_batch? max_batch: 1);
+    }
+
+    // handle elements currently queued; true if there were any. Elements
+    // are swapped out into `scratch` first, so that a slow handler does not
+    // hold up queue elements, and handled up to `scratch.size()` at a time.
+    bool drain(std::vector<T>& scratch) {
+        bool any = false;
+        for (;;) {
+            std::size_t n = 0;
+            {
+                std::lock_guard<std::recursive_mutex> guard(deliver_mex_);
+                while (n<scratch.size() && queue_.try_pop([&scratch, n](T& x) { std::swap(x, scratch[n]); })) ++n;
+                if (!n) break;
+
+                if (h_.deliver_batch) h_.deliver_batch(scratch.data(), n);
+                else for (std::size_t i=0; i<n; ++i) h_.deliver(scratch[i]);
+            }
+
+            consumed_.fetch_add(n, std::memory_order_release);
+            any = true;
+
+            if (waiters_.load()) {
+                lock_type lock(mex_);
+                progress_.notify_all();
+            }
+        }
+        return any;
+    }
+
+    bool drain() {
+        auto scratch = make_scratch();
+        return drain(scratch);
+    }
+
+    void notify_writer() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (writer_idle_.load(std::memory_order_relaxed)) {
+            lock_type lock(mex_);
+            wake_.notify_one();
+        }
+    }
+
+    void wait_for_writer() {
+        lock_type lock(mex_);
+        ++waiters_;
+        wake_.notify_one();
+        progress_.wait_for(lock, std::chrono::milliseconds(1));
+        --waiters_;
+    }
+
+    void run() {
+        writer_id_.store(std::this_thread::get_id(), std::memory_order_release);
+        auto scratch = make_scratch();
+        for (;;) {
+            bool any = drain(scratch);
+
+            auto now = clock_type::now();
+            if (now-last_report_>=report_interval_) {
+                report_drops();
+                last_report_ = now;
+            }
+
+            if (any) continue;
+            if (stopped_.load()) break;
+
+            lock_type lock(mex_);
+            writer_idle_.store(true);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (queue_.empty() && !stopped_.load()) {
+                wake_.wait_for(lock, std::min<clock_type::duration>(report_interval_, std::chrono::milliseconds(100)));
+            }
+            writer_idle_.store(false);
+        }
+    }
+};
+
+template <typename T>
+constexpr std::size_t async_worker<T>::max_batch;
+
+} // namespace log
@@ -0,0 +1,176 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <log/backfill.hpp>
+#include <log/stored_entry.hpp>
+
+namespace log {
+
+namespace {
+
+// Each backfill configuration of a facility has a generation, unique across
+// facilities and managers; rings are keyed by generation, so that a ring
+// kept for a replaced configuration, or for a facility since destroyed, is
+// never used again. Generations are live until replaced or until their
+// facility is destroyed; rings for generations no longer live are pruned
+// whenever a ring is added to a set.
+
+struct generation_registry {
+    std::mutex mex;
+    std::uint64_t next = 1;
+    std::vector<std::uint64_t> live;    // ascending
+
+    void retire(std::uint64_t generation) {
+        auto i = std::lower_bound(live.begin(), live.end(), generation);
+        if (i!=live.end() && *i==generation) live.erase(i);
+    }
+};
+
+// never destroyed: facilities of a static manager may outlive this file's
+// statics.
+generation_registry& generations() {
+    static generation_registry* g = new generation_registry;
+    return *g;
+}
+
+bool generation_live(std::uint64_t generation) {
+    auto& g = generations();
+    std::lock_guard<std::mutex> lock(g.mex);
+    return std::binary_search(g.live.begin(), g.live.end(), generation);
+}
+
+// the last `entries.size()` records kept for one facility configuration in
+// one scope; `stored_entry` reuses its storage, so that a full ring is
+// overwritten without allocation.
+
+struct backfill_ring {
+    std::uint64_t generation;
+    std::vector<stored_entry> entries;
+    std::size_t next = 0;   // slot for the next record
+    std::size_t count = 0;  // records held
+
+    backfill_ring(std::uint64_t generation, unsigned depth): generation(generation), entries(depth) {}
+
+    void store(const log_entry& e) {
+        entries[next].assign(e);
+        next = (next+1)%entries.size();
+        count = std::min(count+1, entries.size());
+    }
+};
+
+struct ring_set {
+    std::vector<backfill_ring> rings;
+
+    backfill_ring* find(std::uint64_t generation) {
+        for (auto& r: rings) {
+            if (r.generation==generation) return &r;
+        }
+        return nullptr;
+    }
+
+    backfill_ring& get(std::uint64_t generation, unsigned depth) {
+        if (backfill_ring* r = find(generation)) return *r;
+
+        rings.erase(std::remove_if(rings.begin(), rings.end(),
+            [](const backfill_ring& r) { return !generation_live(r.generation); }), rings.end());
+        rings.emplace_back(generation, depth);
+        return rings.back();
+    }
+};
+
+thread_local ring_set thread_rings;
+thread_local backfill_scope::state* current_scope = nullptr;
+
+// set while backfilled records are passed to a sink: records logged by the
+// sink itself are not kept, and do not trigger a further backfill.
+thread_local bool flushing = false;
+
+struct flushing_guard {
+    flushing_guard() { flushing = true; }
+    ~flushing_guard() { flushing = false; }
+};
+
+void flush_ring(ring_set& rs, const facility_record* rec, const log_sink_t* sink) {
+    backfill_ring* r = rs.find(rec->backfill_generation.load(std::memory_order_relaxed));
+    if (!r || !r->count) return;
+
+    flushing_guard guard;
+    std::size_t depth = r->entries.size();
+    std::size_t first = (r->next+depth-r->count)%depth;
+    std::size_t n = r->count;
+    r->count = 0;
+
+    for (std::size_t i=0; i<n; ++i) {
+        log_entry e = r->entries[(first+i)%depth].entry();
+        if (sink && *sink) rec->counters.count_backfilled(std::strlen(e.message), rec->call_sink(*sink, e));
+    }
+}
+
+} // anonymous namespace
+
+struct backfill_scope::state {
+    std::mutex mex;
+    ring_set rings;
+};
+
+backfill_scope::backfill_scope(): state_(std::make_shared<state>()) {}
+
+backfill_guard::backfill_guard(const backfill_scope& scope):
+    scope_(scope.state_), previous_(current_scope)
+{
+    current_scope = scope_.get();
+}
+
+backfill_guard::~backfill_guard() {
+    current_scope = previous_;
+}
+
+void facility::backfill(unsigned depth, int trigger) const {
+    data_->backfill_trigger.store(trigger, std::memory_order_relaxed);
+    {
+        auto& g = generations();
+        std::lock_guard<std::mutex> lock(g.mex);
+        std::uint64_t generation = g.next++;
+        g.live.push_back(generation);
+        g.retire(data_->backfill_generation.exchange(generation, std::memory_order_relaxed));
+    }
+    data_->backfill_depth.store(depth, std::memory_order_relaxed);
+}
+
+void backfill_retire(const facility_record* rec) {
+    auto& g = generations();
+    std::lock_guard<std::mutex> lock(g.mex);
+    g.retire(rec->backfill_generation.load(std::memory_order_relaxed));
+}
+
+void backfill_store(const facility_record* rec, const log_entry& entry) {
+    unsigned depth = rec->backfill_depth.load(std::memory_order_relaxed);
+    if (flushing || !depth) return;
+
+    std::uint64_t generation = rec->backfill_generation.load(std::memory_order_relaxed);
+    if (backfill_scope::state* scope = current_scope) {
+        std::lock_guard<std::mutex> lock(scope->mex);
+        scope->rings.get(generation, depth).store(entry);
+    }
+    else {
+        thread_rings.get(generation, depth).store(entry);
+    }
+}
+
+void backfill_flush(const facility_record* rec, const log_sink_t* sink) {
+    if (flushing) return;
+
+    if (backfill_scope::state* scope = current_scope) {
+        std::lock_guard<std::mutex> lock(scope->mex);
+        flush_ring(scope->rings, rec, sink);
+    }
+    else {
+        flush_ring(thread_rings, rec, sink);
+    }
+}
+
+} // namespace log
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory>
+
+#include <log/facility.hpp>
+
+namespace log {
+
+// Backfill: a facility in backfill mode (`facility::backfill`) keeps the
+// records its level would discard, up to a fixed number per scope, and
+// passes them to its sink, oldest first, just before the next record at or
+// below its trigger level from the same scope. Routine records thus cost
+// their composition and a copy into a ring, and the lead-up to an error is
+// logged in full.
+//
+// By default the scope is the logging thread. A `backfill_guard` makes a
+// `backfill_scope` the scope of the calling thread for its lifetime, so
+// that records made on behalf of, say, one request on several threads are
+// kept (and emitted) together; the rings of a scope are guarded by a mutex,
+// held also while backfilled records are passed to the sink.
+//
+// Only records composed with `LOG` or a facility's `operator()` are kept;
+// deferred-formatting (`LOGB`) records below the level are discarded. The
+// trigger record must itself be admitted by the level. Kept records count as
+// filtered in the facility statistics, and as emitted once backfilled.
+
+class backfill_scope {
+public:
+    backfill_scope();
+
+    struct state;
+
+private:
+    friend class backfill_guard;
+    std::shared_ptr<state> state_;
+};
+
+class backfill_guard {
+public:
+    explicit backfill_guard(const backfill_scope& scope);
+    ~backfill_guard();
+
+    backfill_guard(const backfill_guard&) = delete;
+    backfill_guard& operator=(const backfill_guard&) = delete;
+
+private:
+    std::shared_ptr<backfill_scope::state> scope_;
+    backfill_scope::state* previous_;
+};
+
+} // namespace log
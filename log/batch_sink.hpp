@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+#include <log/facility.hpp>
+
+namespace log {
+
+// Batch sinks receive a contiguous array of records in one call, so that a
+// buffering sink can take its lock (or make its system call) once per batch
+// rather than once per record. The records, and the data they refer to, are
+// valid only for the duration of the call.
+
+using log_batch_sink_t = std::function<void (const log_entry*, std::size_t)>;
+
+// `is_batch_sink<Sink>` is true if `Sink` can be called with a record array
+
+template <typename Sink, typename = void>
+struct is_batch_sink: std::false_type {};
+
+template <typename Sink>
+struct is_batch_sink<Sink, decltype(void(std::declval<Sink&>()(std::declval<const log_entry*>(), std::size_t(0))))>:
+    std::true_type {};
+
+// adapt a sink to the batch interface: batch sinks are used as is, while
+// single-record sinks are called for each record in turn.
+
+template <typename Sink>
+typename std::enable_if<is_batch_sink<Sink>::value, log_batch_sink_t>::type
+as_batch_sink(Sink sink) {
+    return log_batch_sink_t(std::move(sink));
+}
+
+template <typename Sink>
+typename std::enable_if<!is_batch_sink<Sink>::value, log_batch_sink_t>::type
+as_batch_sink(Sink sink) {
+    log_sink_t single(std::move(sink));
+    if (!single) return log_batch_sink_t();
+
+    return [single](const log_entry* entries, std::size_t n) {
+        for (std::size_t i=0; i<n; ++i) single(entries[i]);
+    };
+}
+
+// adapt a batch sink to the single-record interface, for use as a facility sink
+
+inline log_sink_t as_record_sink(log_batch_sink_t batch) {
+    if (!batch) return log_sink_t();
+
+    return [batch](const log_entry& entry) { batch(&entry, 1); };
+}
+
+} // namespace log
@@ -0,0 +1,541 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <log/async_worker.hpp>
+#include <log/binary.hpp>
+#include <log/epoch.hpp>
+
+namespace log {
+
+// Record formatting
+
+namespace {
+
+// sequential reader over encoded arguments
+
+struct arg_reader {
+    const unsigned char* p;
+    const unsigned char* end;
+
+    struct arg {
+        arg_tag tag;
+        union {
+            std::int64_t i;
+            std::uint64_t u;
+            double d;
+            char c;
+            const void* ptr;
+        };
+        const char* str;
+        std::size_t len;
+    };
+
+    // read the next argument; false at the end of the arguments, or if
+    // the next one is malformed or runs past `end` (the rest is skipped).
+    bool next(arg& a) {
+        if (p>=end) return false;
+        a.tag = static_cast<arg_tag>(*p++);
+
+        switch (a.tag) {
+        case arg_tag::sint:
+            if (!take(&a.i, 8)) return false;
+            break;
+        case arg_tag::uint:
+            if (!take(&a.u, 8)) return false;
+            break;
+        case arg_tag::real:
+            if (!take(&a.d, 8)) return false;
+            break;
+        case arg_tag::chr:
+            if (!take(&a.c, 1)) return false;
+            break;
+        case arg_tag::ptr:
+            if (!take(&a.ptr, sizeof(a.ptr))) return false;
+            break;
+        case arg_tag::str: {
+                std::uint16_t l;
+                if (!take(&l, 2)) return false;
+                if (static_cast<std::size_t>(end-p)<l) {
+                    p = end;
+                    return false;
+                }
+                a.str = reinterpret_cast<const char*>(p);
+                a.len = l;
+                p += l;
+            }
+            break;
+        default:
+            p = end;
+            return false;
+        }
+        return true;
+    }
+
+    // copy `n` bytes into `x`, if there are that many left
+    bool take(void* x, std::size_t n) {
+        if (static_cast<std::size_t>(end-p)<n) {
+            p = end;
+            return false;
+        }
+        std::memcpy(x, p, n);
+        p += n;
+        return true;
+    }
+
+    static long long as_signed(const arg& a) {
+        switch (a.tag) {
+        case arg_tag::sint: return a.i;
+        case arg_tag::uint: return static_cast<long long>(a.u);
+        case arg_tag::real: return static_cast<long long>(a.d);
+        case arg_tag::chr: return a.c;
+        default: return 0;
+        }
+    }
+
+    static unsigned long long as_unsigned(const arg& a) {
+        return a.tag==arg_tag::uint? a.u: static_cast<unsigned long long>(as_signed(a));
+    }
+
+    static double as_double(const arg& a) {
+        switch (a.tag) {
+        case arg_tag::real: return a.d;
+        case arg_tag::uint: return static_cast<double>(a.u);
+        default: return static_cast<double>(as_signed(a));
+        }
+    }
+};
+
+// output into a fixed buffer, counting the full length
+struct bounded_output {
+    char* buf;
+    std::size_t n;
+    std::size_t len = 0;
+
+    bounded_output(char* b, std::size_t n): buf(b), n(n) {}
+
+    char* at() { return len<n? buf+len: nullptr; }
+    std::size_t room() const { return len<n? n-len: 0; }
+
+    void put(char c) {
+        if (len+1<n) buf[len] = c;
+        ++len;
+    }
+
+    // account for `snprintf` into at()/room()
+    void advance(int k) {
+        if (k>0) len += k;
+    }
+
+    void terminate() {
+        if (n) buf[len<n? len: n-1] = 0;
+    }
+};
+
+// bound on `*` widths and precisions
+constexpr long long max_star = 9999;
+
+} // anonymous namespace
+
+std::size_t binary_record::format_to(char* buf, std::size_t n) const {
+    bounded_output out(buf, n);
+    arg_reader in{args, args+size};
+    arg_reader::arg a;
+
+    // `snprintf` into a scratch byte when no room is left, so as to count
+    char scratch[1];
+
+    const char* f = format? format: "";
+    while (*f) {
+        if (*f!='%') {
+            out.put(*f++);
+            continue;
+        }
+        if (f[1]=='%') {
+            out.put('%');
+            f += 2;
+            continue;
+        }
+
+        // parse conversion specification: flags, width, precision;
+        // length modifiers are discarded and replaced to suit the argument.
+        // At most 8 bytes of '%' and flags, up to 16 with the width, 24 with
+        // the precision (a `*` argument is clamped to at most 5 characters),
+        // and 4 for the length modifier, conversion and terminator.
+        char spec[32];
+        std::size_t k = 0;
+        spec[k++] = *f++;
+
+        while (*f && std::strchr("-+ #0'", *f) && k<8) spec[k++] = *f++;
+
+        // a negative `*` width is a '-' flag; a negative `*` precision is
+        // taken as omitted.
+        auto star = [&](bool precision) {
+            long long v = in.next(a)? arg_reader::as_signed(a): 0;
+            ++f;
+            if (v<0) {
+                if (precision) {
+                    --k;
+                    return false;
+                }
+                spec[k++] = '-';
+                v = -v;
+            }
+            int w = std::snprintf(spec+k, sizeof(spec)-k, "%d", static_cast<int>(std::min(v, max_star)));
+            if (w>0) k += w;
+            return true;
+        };
+
+        if (*f=='*') star(false);
+        else while (*f>='0' && *f<='9' && k<16) spec[k++] = *f++;
+
+        bool has_precision = false;
+        if (*f=='.') {
+            has_precision = true;
+            spec[k++] = *f++;
+            if (*f=='*') has_precision = star(true);
+            else while (*f>='0' && *f<='9' && k<24) spec[k++] = *f++;
+        }
+
+        while (*f && std::strchr("hljztLq", *f)) ++f;
+
+        char conv = *f;
+        if (!conv) break;
+        ++f;
+
+        if (!in.next(a)) continue;
+
+        char* dst = out.at()? out.at(): scratch;
+        std::size_t room = out.at()? out.room(): sizeof(scratch);
+
+        switch (conv) {
+        case 'd': case 'i':
+            spec[k++] = 'l'; spec[k++] = 'l'; spec[k++] = conv; spec[k] = 0;
+            out.advance(std::snprintf(dst, room, spec, arg_reader::as_signed(a)));
+            break;
+        case 'u': case 'o': case 'x': case 'X':
+            spec[k++] = 'l'; spec[k++] = 'l'; spec[k++] = conv; spec[k] = 0;
+            out.advance(std::snprintf(dst, room, spec, arg_reader::as_unsigned(a)));
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            spec[k++] = conv; spec[k] = 0;
+            out.advance(std::snprintf(dst, room, spec, arg_reader::as_double(a)));
+            break;
+        case 'c':
+            spec[k++] = 'c'; spec[k] = 0;
+            out.advance(std::snprintf(dst, room, spec, static_cast<int>(arg_reader::as_signed(a))));
+            break;
+        case 'p':
+            spec[k++] = 'p'; spec[k] = 0;
+            out.advance(std::snprintf(dst, room, spec, a.tag==arg_tag::ptr? a.ptr: nullptr));
+            break;
+        case 's':
+            if (a.tag==arg_tag::str) {
+                // precision bounds the (unterminated) stored string
+                int prec = static_cast<int>(a.len);
+                if (has_precision) {
+                    spec[k] = 0;
+                    char* dot = std::strrchr(spec, '.');
+                    int p = std::atoi(dot+1);
+                    if (p<prec) prec = p;
+                    k = dot-spec;
+                }
+                spec[k++] = '.'; spec[k++] = '*'; spec[k++] = 's'; spec[k] = 0;
+                out.advance(std::snprintf(dst, room, spec, prec, a.str));
+                break;
+            }
+            // fall through: format non-string arguments by type
+        default:
+            switch (a.tag) {
+            case arg_tag::real:
+                out.advance(std::snprintf(dst, room, "%g", a.d));
+                break;
+            case arg_tag::uint:
+                out.advance(std::snprintf(dst, room, "%llu", static_cast<unsigned long long>(a.u)));
+                break;
+            case arg_tag::chr:
+                out.put(a.c);
+                break;
+            case arg_tag::ptr:
+                out.advance(std::snprintf(dst, room, "%p", a.ptr));
+                break;
+            default:
+                out.advance(std::snprintf(dst, room, "%lld", arg_reader::as_signed(a)));
+                break;
+            }
+        }
+    }
+
+    out.terminate();
+    return out.len;
+}
+
+std::string binary_record::message() const {
+    char buf[512];
+    std::size_t len = format_to(buf, sizeof(buf));
+    if (len<sizeof(buf)) return std::string(buf, len);
+
+    std::vector<char> big(len+1);
+    format_to(big.data(), big.size());
+    return std::string(big.data(), len);
+}
+
+// Backend
+
+void binary_to_text(const binary_record& r) {
+    if (!r.facility) return;
+
+    char buf[512];
+    std::vector<char> big;
+    const char* msg = buf;
+
+    std::size_t len = r.format_to(buf, sizeof(buf));
+    if (len>=sizeof(buf)) {
+        big.resize(len+1);
+        r.format_to(big.data(), big.size());
+        msg = big.data();
+    }
+
+    r.facility->emit(log_entry{r.facility->name, r.level, r.location, msg, r.time, r.thread, r.sequence}, len);
+}
+
+namespace {
+
+struct binary_handler_set {
+    binary_sink_t handle;
+    std::function<void ()> flush;
+};
+
+struct binary_backend;
+
+// the backend, while running; constant-initialized, so that managers
+// destroyed after the backend see it cleared.
+std::atomic<binary_backend*> running_backend{nullptr};
+
+struct binary_backend {
+    std::atomic<const binary_handler_set*> handler;
+    std::shared_ptr<async_worker<binary_record>> worker;
+
+    binary_backend(): handler(new binary_handler_set{binary_to_text, nullptr}) {
+        async_worker<binary_record>::handlers h;
+        h.deliver_batch = [this](binary_record* r, std::size_t n) { handle(r, n); };
+        h.name = [](const binary_record& r) { return r.facility? r.facility->name.load(): ""; };
+        h.report = [](const char*, std::uint64_t) {};
+
+        worker = async_worker<binary_record>::start(8192, overflow::block, std::chrono::seconds(1), std::move(h));
+        running_backend.store(this);
+    }
+
+    ~binary_backend() {
+        running_backend.store(nullptr);
+        worker.reset();
+        delete handler.load();
+    }
+
+    void handle(const binary_record* r, std::size_t n) {
+        epoch_guard guard;
+        const binary_handler_set* h = handler.load(std::memory_order_acquire);
+        if (!h || !h->handle) return;
+
+        for (std::size_t i=0; i<n; ++i) h->handle(r[i]);
+        if (h->flush) h->flush();
+    }
+};
+
+binary_backend& backend() {
+    static binary_backend b;
+    return b;
+}
+
+
+} // anonymous namespace
+
+void binary_handler(binary_sink_t handler, std::function<void ()> flush) {
+    auto& b = backend();
+    auto h = new binary_handler_set{std::move(handler), std::move(flush)};
+    const binary_handler_set* old = b.handler.exchange(h, std::memory_order_acq_rel);
+    if (old) epoch_retire(old);
+}
+
+void binary_handler(binary_file_writer writer) {
+    binary_handler(writer, [writer]() mutable { writer.flush(); });
+}
+
+void binary_flush() {
+    backend().worker->flush();
+}
+
+void binary_drain() {
+    if (binary_backend* b = running_backend.load()) b->worker->flush();
+}
+
+void submit_binary(const facility_record* data, int level, source_location loc,
+    const char* format, const std::function<void (binary_record&)>& encode)
+{
+    timestamp time = read_clock(data->manager->clock());
+    std::uint32_t thread = thread_index();
+    std::uint64_t sequence = data->manager->next_sequence();
+
+    auto fill = [&](binary_record& r) {
+        r.facility = data;
+        r.level = level;
+        r.location = loc;
+        r.format = format;
+        r.time = time;
+        r.thread = thread;
+        r.sequence = sequence;
+        r.size = 0;
+        r.truncated = false;
+        encode(r);
+    };
+
+    auto& b = backend();
+    b.worker->submit(data->name,
+        fill,
+        [&]() {
+            binary_record r;
+            fill(r);
+            b.handle(&r, 1);
+        });
+}
+
+// Binary log files
+//
+// A file is a header line, followed by a sequence of items, each introduced
+// by a one-byte type:
+//   'S' id:u32 len:u32 bytes       definition of string `id`
+//   'R' name:u32 level:i32 file:u32 line:i32 func:u32 format:u32
+//       time:u64 thread:u32 sequence:u64
+//       size:u32 args[size]        record; strings by id, 0 for none;
+//                                  time in ns since the Unix epoch.
+
+namespace {
+
+const char binary_log_magic[] = "LOGB 1\n";
+
+template <typename T>
+void put_raw(std::ostream& o, T x) {
+    o.write(reinterpret_cast<const char*>(&x), sizeof(x));
+}
+
+template <typename T>
+bool get_raw(std::istream& i, T& x) {
+    return (bool)i.read(reinterpret_cast<char*>(&x), sizeof(x));
+}
+
+} // anonymous namespace
+
+struct binary_file_writer::state {
+    std::mutex mex;
+    std::ofstream out;
+    std::unordered_map<const void*, std::uint32_t> ids;
+
+    explicit state(const std::string& path): out(path, std::ios::binary) {
+        out.write(binary_log_magic, sizeof(binary_log_magic)-1);
+    }
+
+    std::uint32_t id(const char* s) {
+        if (!s) return 0;
+
+        auto i = ids.find(s);
+        if (i!=ids.end()) return i->second;
+
+        std::uint32_t id = static_cast<std::uint32_t>(ids.size()+1);
+        ids[s] = id;
+
+        std::uint32_t len = static_cast<std::uint32_t>(std::strlen(s));
+        out.put('S');
+        put_raw(out, id);
+        put_raw(out, len);
+        out.write(s, len);
+        return id;
+    }
+};
+
+binary_file_writer::binary_file_writer(const std::string& filepath):
+    state_(std::make_shared<state>(filepath))
+{}
+
+void binary_file_writer::operator()(const binary_record& r) {
+    std::lock_guard<std::mutex> guard(state_->mex);
+    auto& s = *state_;
+
+    std::uint32_t name = s.id(r.facility? r.facility->name.load(): nullptr);
+    std::uint32_t file = s.id(r.location.file);
+    std::uint32_t func = s.id(r.location.func);
+    std::uint32_t format = s.id(r.format);
+
+    s.out.put('R');
+    put_raw(s.out, name);
+    put_raw(s.out, std::int32_t(r.level));
+    put_raw(s.out, file);
+    put_raw(s.out, std::int32_t(r.location.line));
+    put_raw(s.out, func);
+    put_raw(s.out, format);
+    put_raw(s.out, r.time.ticks? wall_time_ns(r.time): std::uint64_t(0));
+    put_raw(s.out, r.thread);
+    put_raw(s.out, r.sequence);
+    put_raw(s.out, r.size);
+    s.out.write(reinterpret_cast<const char*>(r.args), r.size);
+}
+
+void binary_file_writer::flush() {
+    std::lock_guard<std::mutex> guard(state_->mex);
+    state_->out.flush();
+}
+
+std::size_t decode_binary_log(std::istream& in, const log_sink_t& sink) {
+    char magic[sizeof(binary_log_magic)-1];
+    if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, binary_log_magic, sizeof(magic))) return 0;
+
+    std::unordered_map<std::uint32_t, std::string> strings;
+    auto str = [&](std::uint32_t id) -> const char* {
+        auto i = strings.find(id);
+        return i==strings.end()? nullptr: i->second.c_str();
+    };
+
+    std::size_t count = 0;
+    char type;
+    while (in.get(type)) {
+        if (type=='S') {
+            std::uint32_t id, len;
+            if (!get_raw(in, id) || !get_raw(in, len)) break;
+
+            std::string s(len, '\0');
+            if (!in.read(&s[0], len)) break;
+            strings[id] = std::move(s);
+        }
+        else if (type=='R') {
+            std::uint32_t name, file, func, format;
+            std::int32_t level, line;
+            binary_record r;
+
+            if (!get_raw(in, name) || !get_raw(in, level) || !get_raw(in, file) ||
+                !get_raw(in, line) || !get_raw(in, func) || !get_raw(in, format) ||
+                !get_raw(in, r.time.ticks) || !get_raw(in, r.thread) || !get_raw(in, r.sequence) ||
+                !get_raw(in, r.size) || r.size>binary_args_capacity ||
+                !in.read(reinterpret_cast<char*>(r.args), r.size)) break;
+
+            r.level = level;
+            r.format = str(format);
+            if (file) r.location = source_location{str(file), line, str(func)};
+
+            std::string msg = r.message();
+            const char* n = str(name);
+            if (sink) sink(log_entry{n? n: "", r.level, r.location, msg.c_str(), r.time, r.thread, r.sequence});
+            ++count;
+        }
+        else {
+            break;
+        }
+    }
+    return count;
+}
+
+} // namespace log
@@ -0,0 +1,204 @@
+#pragma once
+
+// Deferred-formatting ("binary") log records.
+//
+// `LOGB(fac, n, "x=%d y=%f", x, y)` checks the facility level as `LOG` does;
+// if the record is enabled, the logging thread copies only the format string
+// pointer and the raw argument values into a fixed-size `binary_record`,
+// which is queued for a backend thread. The backend passes each record to a
+// binary handler: by default, this formats the record printf-style and sends
+// the text to the facility's sink; a `binary_file_writer` instead stores
+// records unformatted, to be decoded offline with `decode_binary_log`.
+//
+// Format strings must have static storage duration (in practice, be string
+// literals); string arguments are copied, and truncated if the record runs
+// out of space. Queued records refer to their facility, so destroying a
+// `facility_manager` waits for the backend to handle the records queued so
+// far.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <log/facility.hpp>
+
+namespace log {
+
+// type tags for encoded arguments
+
+enum class arg_tag: unsigned char {
+    sint, uint, real, chr, str, ptr
+};
+
+constexpr std::size_t binary_args_capacity = 192;
+
+struct binary_record {
+    const facility_record* facility = nullptr;
+    int level = 0;
+    source_location location = no_source_location;
+    const char* format = nullptr;   // static storage
+    timestamp time = {clock_source::realtime, 0};
+    std::uint32_t thread = 0;
+    std::uint64_t sequence = 0;
+    std::uint32_t size = 0;         // bytes of `args` in use
+    bool truncated = false;         // not all arguments fitted
+    unsigned char args[binary_args_capacity];
+
+    // append an encoded argument; false if there is no room.
+    bool put(arg_tag tag, const void* data, std::size_t n) {
+        if (truncated || size+1+n>binary_args_capacity) {
+            truncated = true;
+            return false;
+        }
+        args[size++] = static_cast<unsigned char>(tag);
+        std::memcpy(args+size, data, n);
+        size += static_cast<std::uint32_t>(n);
+        return true;
+    }
+
+    // format the record message into `buf`, always NUL-terminated if n>0;
+    // returns the length of the full message, as `snprintf` does.
+    std::size_t format_to(char* buf, std::size_t n) const;
+
+    // formatted record message
+    std::string message() const;
+};
+
+// argument encoding
+
+inline void encode_arg(binary_record& r, const char* s) {
+    if (!s) s = "(null)";
+    std::size_t avail = binary_args_capacity-r.size;
+    if (avail<4) {
+        r.truncated = true;
+        return;
+    }
+
+    std::size_t len = std::strlen(s);
+    if (len>avail-3) len = avail-3;
+    if (len>UINT16_MAX) len = UINT16_MAX;
+
+    std::uint16_t l = static_cast<std::uint16_t>(len);
+    r.args[r.size++] = static_cast<unsigned char>(arg_tag::str);
+    std::memcpy(r.args+r.size, &l, 2);
+    std::memcpy(r.args+r.size+2, s, len);
+    r.size += 2+l;
+}
+
+inline void encode_arg(binary_record& r, const std::string& s) {
+    encode_arg(r, s.c_str());
+}
+
+inline void encode_arg(binary_record& r, char c) {
+    r.put(arg_tag::chr, &c, 1);
+}
+
+inline void encode_arg(binary_record& r, bool b) {
+    std::uint64_t v = b;
+    r.put(arg_tag::uint, &v, sizeof(v));
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+encode_arg(binary_record& r, T x) {
+    std::int64_t v = x;
+    r.put(arg_tag::sint, &v, sizeof(v));
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type
+encode_arg(binary_record& r, T x) {
+    std::uint64_t v = x;
+    r.put(arg_tag::uint, &v, sizeof(v));
+}
+
+template <typename T>
+typename std::enable_if<std::is_enum<T>::value>::type
+encode_arg(binary_record& r, T x) {
+    encode_arg(r, static_cast<typename std::underlying_type<T>::type>(x));
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value>::type
+encode_arg(binary_record& r, T x) {
+    double v = x;
+    r.put(arg_tag::real, &v, sizeof(v));
+}
+
+template <typename T>
+void encode_arg(binary_record& r, const T* p) {
+    const void* v = p;
+    r.put(arg_tag::ptr, &v, sizeof(v));
+}
+
+inline void encode_args(binary_record&) {}
+
+template <typename T, typename... Rest>
+void encode_args(binary_record& r, const T& x, const Rest&... rest) {
+    encode_arg(r, x);
+    encode_args(r, rest...);
+}
+
+// handlers for binary records, called on the backend thread
+
+using binary_sink_t = std::function<void (const binary_record&)>;
+
+// format record and pass it to its facility's sink (the default handler)
+void binary_to_text(const binary_record& r);
+
+class binary_file_writer;
+
+// set the handler for binary records; `flush`, if given, is called on the
+// backend thread after each batch of records is handled. A
+// `binary_file_writer` is flushed after each batch.
+void binary_handler(binary_sink_t handler, std::function<void ()> flush = nullptr);
+void binary_handler(binary_file_writer writer);
+
+// wait until every binary record logged before the call has been handled
+void binary_flush();
+
+// queue a record for the backend
+void submit_binary(const facility_record* data, int level, source_location loc,
+    const char* format, const std::function<void (binary_record&)>& encode);
+
+template <std::size_t N, typename... Args>
+void log_binary(const facility_record* data, int level, source_location loc,
+    const char (&format)[N], const Args&... args)
+{
+    // (held by reference, so that constructing the std::function does not
+    // allocate)
+    auto encode = [&](binary_record& r) { encode_args(r, args...); };
+    submit_binary(data, level, loc, format, std::ref(encode));
+}
+
+// `binary_file_writer` is a binary record handler that writes records
+// unformatted to a file, for decoding with `decode_binary_log`. Strings
+// referenced by records (format strings, facility names, source locations)
+// are written to the file once, the first time they are seen. Timestamps are
+// stored as wall time. Output is buffered until `flush`, or until the file is
+// closed with the last copy of the writer.
+
+class binary_file_writer {
+public:
+    explicit binary_file_writer(const std::string& filepath);
+
+    void operator()(const binary_record& r);
+    void flush();
+
+private:
+    struct state;
+    std::shared_ptr<state> state_;
+};
+
+// decode records written by a `binary_file_writer`, passing each to `sink`;
+// returns the number of records decoded.
+std::size_t decode_binary_log(std::istream& in, const log_sink_t& sink);
+
+} // namespace log
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace log {
+
+// `bounded_queue` is a fixed-capacity, lock-free FIFO for any number of
+// producers and consumers (after D. Vyukov's bounded MPMC queue).
+//
+// Elements are default-constructed up front and are filled and consumed in
+// place, so that storage held by an element (e.g. string capacity) is reused
+// as the queue cycles.
+
+template <typename T>
+class bounded_queue {
+public:
+    // capacity is rounded up to a power of two
+    explicit bounded_queue(std::size_t capacity) {
+        std::size_t n = 2;
+        while (n<capacity) n *= 2;
+
+        cells_.reset(new cell[n]);
+        mask_ = n-1;
+        for (std::size_t i=0; i<n; ++i) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bounded_queue(const bounded_queue&) = delete;
+    bounded_queue& operator=(const bounded_queue&) = delete;
+
+    std::size_t capacity() const { return mask_+1; }
+
+    // claim a free element and call `fill(T&)` on it; false if full.
+    template <typename Fill>
+    bool try_push(Fill&& fill) {
+        std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell& c = cells_[pos&mask_];
+            std::size_t seq = c.seq.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(seq-pos);
+
+            if (diff==0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
+                    fill(c.value);
+                    c.seq.store(pos+1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff<0) {
+                return false;
+            }
+            else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // take the oldest element and call `consume(T&)` on it; false if empty.
+    template <typename Consume>
+    bool try_pop(Consume&& consume) {
+        std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            cell& c = cells_[pos&mask_];
+            std::size_t seq = c.seq.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(seq-(pos+1));
+
+            if (diff==0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
+                    consume(c.value);
+                    c.seq.store(pos+mask_+1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff<0) {
+                return false;
+            }
+            else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // number of elements ever claimed by producers
+    std::size_t pushed() const { return enqueue_pos_.load(std::memory_order_acquire); }
+
+    // number of elements ever claimed by consumers
+    std::size_t popped() const { return dequeue_pos_.load(std::memory_order_acquire); }
+
+    bool empty() const { return popped()>=pushed(); }
+
+private:
+    struct cell {
+        std::atomic<std::size_t> seq;
+        T value;
+    };
+
+    std::unique_ptr<cell[]> cells_;
+    std::size_t mask_;
+
+    alignas(64) std::atomic<std::size_t> enqueue_pos_{0};
+    alignas(64) std::atomic<std::size_t> dequeue_pos_{0};
+};
+
+} // namespace log
@@ -0,0 +1,224 @@
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+
+#include <log/clock.hpp>
+
+#if LOG_HAVE_RDTSC
+#include <cpuid.h>
+#endif
+
+namespace log {
+
+namespace {
+
+std::uint64_t read_ns(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return static_cast<std::uint64_t>(ts.tv_sec)*1000000000ull+ts.tv_nsec;
+}
+
+// offset of CLOCK_REALTIME from CLOCK_MONOTONIC, taken from the tighter of a
+// few bracketing readings.
+std::int64_t measure_monotonic_offset() {
+    std::uint64_t best_span = UINT64_MAX;
+    std::int64_t offset = 0;
+
+    for (int i=0; i<4; ++i) {
+        std::uint64_t m0 = read_ns(CLOCK_MONOTONIC);
+        std::uint64_t r = read_ns(CLOCK_REALTIME);
+        std::uint64_t m1 = read_ns(CLOCK_MONOTONIC);
+
+        if (m1-m0<best_span) {
+            best_span = m1-m0;
+            offset = static_cast<std::int64_t>(r-(m0+(m1-m0)/2));
+        }
+    }
+    return offset;
+}
+
+std::atomic<std::uint32_t> next_thread_index{1};
+
+// TSC calibration: a (ticks, wall ns) reference point and a rate, published
+// under a sequence lock so that conversions need not take a mutex.
+
+struct tsc_sample {
+    std::uint64_t ticks;
+    std::uint64_t ns;
+};
+
+// pair a tick reading with CLOCK_REALTIME, taken from the tightest of a few
+// bracketing readings.
+tsc_sample take_tsc_sample() {
+    tsc_sample best{0, 0};
+    std::uint64_t best_span = UINT64_MAX;
+
+    for (int i=0; i<4; ++i) {
+        std::uint64_t t0 = tsc_clock::now();
+        std::uint64_t r = read_ns(CLOCK_REALTIME);
+        std::uint64_t t1 = tsc_clock::now();
+
+        if (t1-t0<best_span) {
+            best_span = t1-t0;
+            best = tsc_sample{t0+(t1-t0)/2, r};
+        }
+    }
+    return best;
+}
+
+struct tsc_calibration {
+    std::mutex mex;          // serializes calibration updates
+    std::once_flag initialized;
+    tsc_sample origin;       // first calibration point, guarded by `mex`
+
+    std::atomic<unsigned> seq{0};
+    std::atomic<std::uint64_t> base_ticks{0};
+    std::atomic<std::uint64_t> base_ns{0};
+    std::atomic<double> ns_per_tick{1.};
+    std::atomic<std::uint64_t> refresh_ticks{UINT64_MAX}; // ticks between refreshes
+
+    // with `mex` held
+    void publish(tsc_sample base, double rate) {
+        unsigned s = seq.load(std::memory_order_relaxed);
+        seq.store(s+1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        base_ticks.store(base.ticks, std::memory_order_relaxed);
+        base_ns.store(base.ns, std::memory_order_relaxed);
+        ns_per_tick.store(rate, std::memory_order_relaxed);
+        refresh_ticks.store(static_cast<std::uint64_t>(1e9/rate), std::memory_order_relaxed);
+
+        seq.store(s+2, std::memory_order_release);
+    }
+
+    void read(std::uint64_t& ticks, std::uint64_t& ns, double& rate, std::uint64_t& refresh) const {
+        for (;;) {
+            unsigned s0 = seq.load(std::memory_order_acquire);
+            ticks = base_ticks.load(std::memory_order_relaxed);
+            ns = base_ns.load(std::memory_order_relaxed);
+            rate = ns_per_tick.load(std::memory_order_relaxed);
+            refresh = refresh_ticks.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (!(s0&1) && seq.load(std::memory_order_relaxed)==s0) return;
+        }
+    }
+
+    void init() {
+        std::lock_guard<std::mutex> guard(mex);
+        origin = take_tsc_sample();
+        if (!tsc_clock::invariant()) {
+            publish(origin, 1.);
+            return;
+        }
+
+        // initial rate from a short interval, refined on each refresh
+        tsc_sample s;
+        do {
+            s = take_tsc_sample();
+        } while (s.ns-origin.ns<1000000);
+        publish(s, double(s.ns-origin.ns)/double(s.ticks-origin.ticks));
+    }
+
+    // with `mex` held
+    void refresh() {
+        tsc_sample s = take_tsc_sample();
+        double rate = tsc_clock::invariant()?
+            double(s.ns-origin.ns)/double(s.ticks-origin.ticks): 1.;
+        publish(s, rate);
+    }
+};
+
+tsc_calibration& tsc_cal() {
+    static tsc_calibration cal;
+    std::call_once(cal.initialized, [] { cal.init(); });
+    return cal;
+}
+
+} // anonymous namespace
+
+bool tsc_clock::detect_invariant() {
+#if LOG_HAVE_RDTSC
+    // CPUID.80000007H:EDX[8] indicates an invariant TSC
+    unsigned a, b, c, d;
+    if (!__get_cpuid(0x80000000, &a, &b, &c, &d) || a<0x80000007) return false;
+    __get_cpuid(0x80000007, &a, &b, &c, &d);
+    return d & (1u<<8);
+#else
+    return false;
+#endif
+}
+
+void tsc_clock::calibrate() {
+    tsc_cal();
+}
+
+void tsc_clock::recalibrate() {
+    auto& cal = tsc_cal();
+    std::lock_guard<std::mutex> guard(cal.mex);
+    cal.refresh();
+}
+
+std::uint64_t tsc_clock::to_wall_ns(std::uint64_t ticks) {
+    auto& cal = tsc_cal();
+
+    std::uint64_t base_ticks, base_ns, refresh;
+    double rate;
+    cal.read(base_ticks, base_ns, rate, refresh);
+
+    // refresh the calibration if stale, unless another thread is doing so
+    std::uint64_t now = tsc_clock::now();
+    if (now-base_ticks>refresh) {
+        std::unique_lock<std::mutex> lock(cal.mex, std::try_to_lock);
+        if (lock) {
+            cal.refresh();
+            cal.read(base_ticks, base_ns, rate, refresh);
+        }
+    }
+
+    std::int64_t delta = static_cast<std::int64_t>(ticks-base_ticks);
+    return base_ns+static_cast<std::int64_t>(delta*rate);
+}
+
+double tsc_clock::ticks_per_second() {
+    std::uint64_t base_ticks, base_ns, refresh;
+    double rate;
+    tsc_cal().read(base_ticks, base_ns, rate, refresh);
+    return 1e9/rate;
+}
+
+std::uint64_t wall_time_ns(timestamp t) {
+    switch (t.clock) {
+    case clock_source::realtime:
+        return t.ticks;
+    case clock_source::monotonic_coarse: {
+            static const std::int64_t offset = measure_monotonic_offset();
+            return t.ticks+offset;
+        }
+    case clock_source::tsc:
+        return tsc_clock::to_wall_ns(t.ticks);
+    }
+    return t.ticks;
+}
+
+std::size_t format_wall_time(char* buf, std::size_t n, timestamp t) {
+    std::uint64_t ns = wall_time_ns(t);
+    std::time_t secs = static_cast<std::time_t>(ns/1000000000ull);
+    unsigned usecs = static_cast<unsigned>(ns%1000000000ull/1000);
+
+    struct tm tm;
+    gmtime_r(&secs, &tm);
+
+    int len = std::snprintf(buf, n, "%04d-%02d-%02dT%02d:%02d:%02d.%06uZ",
+        tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, usecs);
+    return len>0? len: 0;
+}
+
+thread_local std::uint32_t impl::thread_index = 0;
+
+std::uint32_t impl::assign_thread_index() {
+    return thread_index = next_thread_index.fetch_add(1, std::memory_order_relaxed);
+}
+
+} // namespace log
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define LOG_HAVE_RDTSC 1
+#else
+#define LOG_HAVE_RDTSC 0
+#endif
+
+namespace log {
+
+// clocks for record timestamps
+
+enum class clock_source {
+    realtime,          // CLOCK_REALTIME: wall time, nanosecond resolution
+    monotonic_coarse,  // CLOCK_MONOTONIC_COARSE: resolution of the kernel tick
+    tsc                // `tsc_clock`: time stamp counter, calibrated off the hot path
+};
+
+// `tsc_clock` reads the processor time stamp counter, which costs a few
+// nanoseconds, and converts ticks to wall time with a calibration against
+// CLOCK_REALTIME. The calibration is taken on first use (`calibrate`, which
+// takes about a millisecond), and refreshed by `to_wall_ns` once a second's
+// worth of ticks has passed; its rate is measured over the whole time since
+// the first calibration.
+//
+// If the counter is not invariant (or not available), ticks are instead
+// CLOCK_MONOTONIC nanoseconds, and are converted by offset alone.
+
+class tsc_clock {
+public:
+    // true if ticks are read from an invariant time stamp counter
+    static bool invariant() {
+        static const bool usable = detect_invariant();
+        return usable;
+    }
+
+    static std::uint64_t now() {
+#if LOG_HAVE_RDTSC
+        if (invariant()) return __rdtsc();
+#endif
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<std::uint64_t>(ts.tv_sec)*1000000000ull+ts.tv_nsec;
+    }
+
+    // take the initial calibration, if not already taken
+    static void calibrate();
+
+    // refresh the calibration now
+    static void recalibrate();
+
+    // convert ticks to nanoseconds since the Unix epoch
+    static std::uint64_t to_wall_ns(std::uint64_t ticks);
+
+    // current estimate of the tick rate
+    static double ticks_per_second();
+
+private:
+    static bool detect_invariant();
+};
+
+// raw record timestamp in the units of its clock; `ticks` is zero if the
+// record has no timestamp.
+
+struct timestamp {
+    clock_source clock;
+    std::uint64_t ticks;
+};
+
+inline timestamp read_clock(clock_source c) {
+    if (c==clock_source::tsc) return timestamp{c, tsc_clock::now()};
+
+    struct timespec ts;
+    clock_gettime(c==clock_source::realtime? CLOCK_REALTIME: CLOCK_MONOTONIC_COARSE, &ts);
+    return timestamp{c, static_cast<std::uint64_t>(ts.tv_sec)*1000000000ull+ts.tv_nsec};
+}
+
+// convert a timestamp to nanoseconds since the Unix epoch; CLOCK_MONOTONIC_COARSE
+// is related to wall time by an offset measured on first use.
+std::uint64_t wall_time_ns(timestamp t);
+
+// format a timestamp as UTC ISO 8601 with microseconds into `buf`, e.g.
+// "2024-01-31T12:34:56.123456Z"; returns the length, as `snprintf` does.
+std::size_t format_wall_time(char* buf, std::size_t n, timestamp t);
+
+// compact thread id: small integers, assigned in order of first use.
+
+namespace impl {
+    extern thread_local std::uint32_t thread_index;  // zero until assigned
+    std::uint32_t assign_thread_index();
+}
+
+inline std::uint32_t thread_index() {
+    std::uint32_t i = impl::thread_index;
+    return i? i: impl::assign_thread_index();
+}
+
+} // namespace log
@@ -0,0 +1,247 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <log/dedup_sink.hpp>
+#include <log/fields.hpp>
+#include <log/stored_entry.hpp>
+
+namespace log {
+
+namespace {
+
+// FNV-1a
+struct entry_hash {
+    std::uint64_t h = 14695981039346656037ull;
+
+    void mix(const void* p, std::size_t n) {
+        auto c = static_cast<const unsigned char*>(p);
+        for (std::size_t i=0; i<n; ++i) {
+            h ^= c[i];
+            h *= 1099511628211ull;
+        }
+    }
+
+    template <typename T>
+    void mix(const T& v) { mix(&v, sizeof(v)); }
+
+    // include the terminator, so that adjacent strings do not run together
+    void mix(const char* s) { mix(s? s: "", std::strlen(s? s: "")+1); }
+};
+
+std::uint64_t hash(const log_entry& e) {
+    entry_hash h;
+    h.mix(e.name);
+    h.mix(e.level);
+    h.mix(e.location.file);
+    h.mix(e.location.line);
+    h.mix(e.location.func);
+    h.mix(e.message);
+    for (std::size_t i=0; i<e.n_fields; ++i) {
+        const log_field& f = e.fields[i];
+        h.mix(f.key);
+        h.mix(f.type);
+        if (f.type==field_type::string) h.mix(f.s);
+        else if (f.type==field_type::boolean) h.mix(f.b);
+        else h.mix(f.u);
+    }
+    return h.h;
+}
+
+bool same_string(const char* a, const char* b) {
+    return !std::strcmp(a? a: "", b? b: "");
+}
+
+bool same_field(const log_field& a, const log_field& b) {
+    if (a.type!=b.type || !same_string(a.key, b.key)) return false;
+    switch (a.type) {
+    case field_type::string: return same_string(a.s, b.s);
+    case field_type::boolean: return a.b==b.b;
+    default: return a.u==b.u;
+    }
+}
+
+// equal in the parts that are hashed
+bool same_record(const log_entry& a, const log_entry& b) {
+    if (a.level!=b.level || a.n_fields!=b.n_fields) return false;
+    if (!same_string(a.name, b.name) || !same_string(a.message, b.message)) return false;
+
+    if (!a.location.file || !b.location.file) {
+        if (a.location.file || b.location.file) return false;
+    }
+    else if (a.location.line!=b.location.line || !same_string(a.location.file, b.location.file) ||
+             !same_string(a.location.func, b.location.func)) return false;
+
+    for (std::size_t i=0; i<a.n_fields; ++i) {
+        if (!same_field(a.fields[i], b.fields[i])) return false;
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+// The wrapped sink is called without `mex` held, by one thread at a time:
+// the first thread with a record to pass on becomes the emitter, and passes
+// on its own record together with any queued by other threads meanwhile, in
+// order; other threads queue copies of their records and return.
+
+struct dedup_sink::state {
+    using clock = std::chrono::steady_clock;
+
+    log_sink_t sink;
+    clock::duration window;
+
+    std::mutex mex;
+    std::condition_variable wake;
+    bool stop = false;
+    std::thread worker;
+
+    bool have_last = false;
+    std::uint64_t last_hash = 0;
+    stored_entry last;             // last record passed on
+    stored_entry repeat;           // last suppressed record of the current run
+    std::uint64_t repeats = 0;     // suppressed records not yet reported
+    clock::time_point due;         // when to report them
+    std::uint64_t total = 0;
+    std::vector<log_field> fields; // scratch for the report
+
+    bool emitting = false;
+    std::vector<stored_entry> queued;   // records to pass on, in order
+    std::size_t n_queued = 0;
+    std::vector<stored_entry> outgoing; // emitter only
+
+    state(log_sink_t s, clock::duration w): sink(std::move(s)), window(w) {
+        worker = std::thread([this]() { run(); });
+    }
+
+    ~state() {
+        std::unique_lock<std::mutex> lock(mex);
+        stop = true;
+        lock.unlock();
+        wake.notify_one();
+        worker.join();
+
+        lock.lock();
+        report(lock);
+    }
+
+    void put(const log_entry& e) {
+        std::uint64_t h = hash(e);
+
+        std::unique_lock<std::mutex> lock(mex);
+        if (have_last && h==last_hash && same_record(e, last.entry())) {
+            if (!repeats) {
+                due = clock::now()+window;
+                wake.notify_one();
+            }
+            repeat.assign(e);
+            ++repeats;
+            ++total;
+            return;
+        }
+
+        queue_report();
+        have_last = true;
+        last_hash = h;
+        last.assign(e);
+
+        if (emitting) {
+            enqueue(e);
+            return;
+        }
+
+        // (a queued report precedes `e`, and records queued while it is
+        // passed on follow it)
+        emitting = true;
+        if (n_queued) {
+            enqueue(e);
+        }
+        else {
+            lock.unlock();
+            if (sink) sink(e);
+            lock.lock();
+        }
+        emit_queued(lock);
+        emitting = false;
+    }
+
+    // pass on the pending repeat count, unless another thread is emitting,
+    // in which case it will; with `mex` held by `lock`
+    void report(std::unique_lock<std::mutex>& lock) {
+        queue_report();
+        if (emitting) return;
+
+        emitting = true;
+        emit_queued(lock);
+        emitting = false;
+    }
+
+    // with `mex` held
+    void queue_report() {
+        if (!repeats) return;
+
+        log_entry e = repeat.entry();
+        fields.assign(e.fields, e.fields+e.n_fields);
+        fields.push_back(kv("repeated", repeats));
+        e.fields = fields.data();
+        e.n_fields = fields.size();
+
+        repeats = 0;
+        enqueue(e);
+    }
+
+    // with `mex` held
+    void enqueue(const log_entry& e) {
+        if (n_queued==queued.size()) queued.emplace_back();
+        queued[n_queued++].assign(e);
+    }
+
+    // emitter only, with `mex` held by `lock`; released while calling the sink
+    void emit_queued(std::unique_lock<std::mutex>& lock) {
+        while (n_queued) {
+            std::size_t n = n_queued;
+            n_queued = 0;
+            std::swap(queued, outgoing);
+
+            lock.unlock();
+            for (std::size_t i=0; i<n; ++i) {
+                if (sink) sink(outgoing[i].entry());
+            }
+            lock.lock();
+        }
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mex);
+        while (!stop) {
+            if (!repeats) wake.wait(lock);
+            else if (clock::now()<due) wake.wait_until(lock, due);
+            else report(lock);
+        }
+    }
+};
+
+dedup_sink::dedup_sink(log_sink_t sink, std::chrono::milliseconds window):
+    state_(std::make_shared<state>(std::move(sink), window))
+{}
+
+void dedup_sink::operator()(const log_entry& entry) {
+    state_->put(entry);
+}
+
+void dedup_sink::flush() {
+    std::unique_lock<std::mutex> lock(state_->mex);
+    state_->report(lock);
+}
+
+std::uint64_t dedup_sink::suppressed() const {
+    std::lock_guard<std::mutex> lock(state_->mex);
+    return state_->total;
+}
+
+} // namespace log
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include <log/facility.hpp>
+
+namespace log {
+
+// `dedup_sink` collapses runs of identical records passed to a wrapped sink.
+//
+// Records are compared by facility name, level, source location, message and
+// key/value fields (but not by timestamp, thread or sequence number), first
+// by a 64-bit hash and then, if the hashes match, in full against a copy of
+// the last record passed on. A record identical to the one before it is
+// suppressed; once the run ends, or `window` after the first suppressed
+// record of the run, the last suppressed record is passed on with the field
+// `repeated` giving the number suppressed. A run that lasts longer than
+// `window` is thus reported once per window.
+//
+// A record that is not suppressed costs a hash and a copy on top of the
+// wrapped sink. Calls to the wrapped sink are serialized, but made without
+// the sink's lock held: a record arriving while another thread is in the
+// wrapped sink is queued, and passed on by that thread, in order. The
+// wrapped sink may thus log through the `dedup_sink` itself. Copies of a
+// `dedup_sink` share their state and timer thread, which is stopped (after
+// reporting any pending count) when the last copy is destroyed.
+
+class dedup_sink {
+public:
+    explicit dedup_sink(log_sink_t sink, std::chrono::milliseconds window = std::chrono::seconds(1));
+
+    void operator()(const log_entry& entry);
+
+    // report any pending repeat count now
+    void flush();
+
+    // total number of records suppressed
+    std::uint64_t suppressed() const;
+
+private:
+    struct state;
+    std::shared_ptr<state> state_;
+};
+
+} // namespace log
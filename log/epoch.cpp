@@ -0,0 +1,164 @@
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <log/epoch.hpp>
+
+namespace log {
+
+namespace {
+
+constexpr std::uint64_t idle = ~std::uint64_t(0);
+
+// Each thread announces the global epoch it observed on entry in a slot of
+// its own; slots are never freed, but are reused by later threads.
+
+struct alignas(64) epoch_slot {
+    std::atomic<std::uint64_t> epoch{idle};
+    std::atomic<bool> in_use{false};
+    epoch_slot* next = nullptr;
+};
+
+std::atomic<std::uint64_t> global_epoch{0};
+std::atomic<epoch_slot*> slot_list{nullptr};
+
+epoch_slot* acquire_slot() {
+    for (auto s = slot_list.load(std::memory_order_acquire); s; s = s->next) {
+        bool expected = false;
+        if (!s->in_use.load(std::memory_order_relaxed) &&
+            s->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        {
+            return s;
+        }
+    }
+
+    auto s = new epoch_slot;
+    s->in_use.store(true, std::memory_order_relaxed);
+    auto head = slot_list.load(std::memory_order_relaxed);
+    do {
+        s->next = head;
+    } while (!slot_list.compare_exchange_weak(head, s, std::memory_order_release, std::memory_order_relaxed));
+    return s;
+}
+
+struct thread_slot {
+    epoch_slot* slot = nullptr;
+    unsigned depth = 0;
+
+    ~thread_slot() {
+        if (slot) {
+            slot->epoch.store(idle, std::memory_order_release);
+            slot->in_use.store(false, std::memory_order_release);
+            slot = nullptr;
+        }
+    }
+};
+
+thread_local thread_slot this_thread_slot;
+
+struct retired_object {
+    std::uint64_t epoch;
+    void* ptr;
+    void (*deleter)(void*);
+};
+
+struct retired_list {
+    std::mutex mex;
+    std::vector<retired_object> objects;
+
+    // anything left over is destroyed at exit
+    ~retired_list() {
+        for (auto& r: objects) r.deleter(r.ptr);
+    }
+};
+
+retired_list& retired() {
+    static retired_list list;
+    return list;
+}
+
+// remove from the retired list those objects that can be destroyed, and
+// return them; list mutex must be held.
+std::vector<retired_object> collect(retired_list& list) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    std::uint64_t min_epoch = idle;
+    for (auto s = slot_list.load(std::memory_order_acquire); s; s = s->next) {
+        std::uint64_t e = s->epoch.load(std::memory_order_acquire);
+        if (e<min_epoch) min_epoch = e;
+    }
+
+    std::vector<retired_object> done;
+    std::size_t j = 0;
+    for (auto& r: list.objects) {
+        if (r.epoch<min_epoch) done.push_back(r);
+        else list.objects[j++] = r;
+    }
+    list.objects.resize(j);
+    return done;
+}
+
+} // anonymous namespace
+
+void epoch_enter() {
+    thread_slot& ts = this_thread_slot;
+    if (ts.depth++) return;
+
+    if (!ts.slot) ts.slot = acquire_slot();
+    ts.slot->epoch.store(global_epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void epoch_exit() {
+    thread_slot& ts = this_thread_slot;
+    if (--ts.depth) return;
+
+    ts.slot->epoch.store(idle, std::memory_order_release);
+}
+
+// An object retired at epoch E may be referenced only by threads that
+// entered having observed an epoch of at most E.
+void epoch_retire(void* p, void (*deleter)(void*)) {
+    auto& list = retired();
+    std::vector<retired_object> done;
+    {
+        std::lock_guard<std::mutex> guard(list.mex);
+        std::uint64_t e = global_epoch.fetch_add(1, std::memory_order_seq_cst);
+        list.objects.push_back(retired_object{e, p, deleter});
+        done = collect(list);
+    }
+    // deleters may themselves retire objects
+    for (auto& r: done) r.deleter(r.ptr);
+}
+
+void epoch_reclaim() {
+    auto& list = retired();
+    std::vector<retired_object> done;
+    {
+        std::lock_guard<std::mutex> guard(list.mex);
+        done = collect(list);
+    }
+    for (auto& r: done) r.deleter(r.ptr);
+}
+
+void epoch_synchronize() {
+    std::uint64_t e = global_epoch.fetch_add(1, std::memory_order_seq_cst);
+
+    for (;;) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        bool waiting = false;
+        for (auto s = slot_list.load(std::memory_order_acquire); s; s = s->next) {
+            if (s->epoch.load(std::memory_order_acquire)<=e) {
+                waiting = true;
+                break;
+            }
+        }
+        if (!waiting) return;
+        std::this_thread::yield();
+    }
+}
+
+} // namespace log
@@ -0,0 +1,46 @@
+#pragma once
+
+// Epoch-based reclamation for objects shared with logging threads.
+//
+// A thread reading a shared pointer does so within an `epoch_guard`; an
+// object that has been unpublished is handed to `epoch_retire`, and is
+// destroyed only once every thread that was inside a guard at the time of
+// retirement has left it. Readers never block and never write to memory
+// shared with other readers.
+
+namespace log {
+
+// mark the calling thread as (possibly) holding protected references;
+// may be nested.
+void epoch_enter();
+void epoch_exit();
+
+struct epoch_guard {
+    epoch_guard() { epoch_enter(); }
+    ~epoch_guard() { epoch_exit(); }
+
+    epoch_guard(const epoch_guard&) = delete;
+    epoch_guard& operator=(const epoch_guard&) = delete;
+};
+
+// destroy `p` with `deleter` once no reader can reference it; `p` must
+// already be unreachable for new readers. Never waits for readers: objects
+// that cannot yet be destroyed are retained, and reclaimed by a later call
+// or at program exit.
+void epoch_retire(void* p, void (*deleter)(void*));
+
+template <typename T>
+void epoch_retire(T* p) {
+    epoch_retire(const_cast<void*>(static_cast<const void*>(p)),
+        [](void* q) { delete static_cast<T*>(q); });
+}
+
+// destroy any retired objects that are no longer referenced.
+void epoch_reclaim();
+
+// wait until every thread that was inside a guard at the time of the call
+// has left it; must not be called from within a guard. For a writer that
+// must release a resource (rather than free memory) once it is unpublished.
+void epoch_synchronize();
+
+} // namespace log
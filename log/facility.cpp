@@ -1,3 +1,13 @@
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <cstring>
+#include <new>
+#include <set>
+#include <string>
+
+#include <fnmatch.h>
+
 #include <log/facility.hpp>
 #include <log/sinks.hpp>
 
@@ -7,32 +17,328 @@ namespace log {
 
 facility_manager g_facility_manager(stream_sink(std::cerr, flag::noemitloc));
 
+// per-thread pool of record buffers
+
+namespace {
+constexpr std::size_t max_pooled_bufs = 8;
+constexpr std::size_t max_pooled_capacity = 1<<16;
+
+// set once the thread's pool has been destroyed, so that records completed
+// during thread teardown do not touch it.
+thread_local bool buf_pool_expired = false;
+
+struct record_buf_pool {
+    std::vector<std::unique_ptr<record_buf>> bufs;
+
+    record_buf_pool() { bufs.reserve(max_pooled_bufs); }
+    ~record_buf_pool() { buf_pool_expired = true; }
+};
+
+thread_local record_buf_pool buf_pool;
+}
+
+constexpr std::size_t record_buf::initial_size;
+
+record_buf* record_buf::acquire() {
+    if (!buf_pool_expired && !buf_pool.bufs.empty()) {
+        record_buf* buf = buf_pool.bufs.back().release();
+        buf_pool.bufs.pop_back();
+        return buf;
+    }
+    return new record_buf;
+}
+
+void record_buf::release(record_buf* buf) {
+    std::unique_ptr<record_buf> owned(buf);
+    if (buf_pool_expired || buf->capacity()>max_pooled_capacity) return;
+
+    if (buf_pool.bufs.size()<max_pooled_bufs) {
+        buf->reset();
+        buf_pool.bufs.push_back(std::move(owned));
+    }
+}
+
+facility_manager::~facility_manager() {
+    binary_drain();
+}
+
 facility_record* facility_manager::get(const char* name) {
-    std::lock_guard<std::mutex> guard(mgr_mex_);
+    if (auto rec = tbl_.find(name)) return rec;
+
+    mex_guard guard(mgr_mex_);
+    if (auto rec = tbl_.find(name)) return rec;
+
+    // (the inherited level is set before the record is published)
+    facility_record* parent = ancestor(name);
+    std::unique_ptr<facility_record> rec(new facility_record);
+    rec->manager = this;
+    rec->level.store(inherited_level(parent));
+    rec->sink.store(new log_sink_t(default_sink_), std::memory_order_relaxed);
+    rec->name = tbl_.insert(name, rec.get());
+    link(rec.get(), parent);
+
+    records_.push_back(std::move(rec));
+    return records_.back().get();
+}
+
+// Name hierarchy
+//
+// Each record is linked to its nearest existing ancestor by dotted name
+// (or listed in `roots_`), and caches its effective level in `level`. A
+// change of level is pushed down the subtree below the record, stopping at
+// records with a level of their own, and at records that already have the
+// new level: below a record, inheriting records always share its level.
+
+namespace {
+
+// true if `name` lies below `prefix` in the hierarchy
+bool descends_from(const char* name, const char* prefix) {
+    std::size_t n = std::strlen(prefix);
+    return !std::strncmp(name, prefix, n) && name[n]=='.';
+}
+
+void remove_child(std::vector<facility_record*>& v, facility_record* rec) {
+    v.erase(std::find(v.begin(), v.end(), rec));
+}
+
+} // anonymous namespace
+
+facility_record* facility_manager::ancestor(const char* name) {
+    std::string prefix(name);
+    facility_record* parent = nullptr;
+    for (auto dot = prefix.rfind('.'); !parent && dot!=std::string::npos; dot = prefix.rfind('.')) {
+        prefix.resize(dot);
+        parent = tbl_.find(prefix.c_str());
+    }
+    return parent;
+}
+
+int facility_manager::inherited_level(const facility_record* parent) const {
+    return parent? parent->level.load(): default_level_.load();
+}
+
+void facility_manager::link(facility_record* ptr, facility_record* parent) {
+    // adopt the records that now have `ptr` as their nearest ancestor
+    auto& siblings = parent? parent->children: roots_;
+    for (auto i = siblings.begin(); i!=siblings.end(); ) {
+        if (descends_from((*i)->name, ptr->name)) {
+            (*i)->parent = ptr;
+            ptr->children.push_back(*i);
+            i = siblings.erase(i);
+        }
+        else {
+            ++i;
+        }
+    }
+
+    ptr->parent = parent;
+    siblings.push_back(ptr);
+    if (!ptr->level_set) ptr->level = inherited_level(parent);
+    propagate(ptr);
+}
+
+void facility_manager::unlink(facility_record* ptr) {
+    facility_record* parent = ptr->parent;
+    auto& siblings = parent? parent->children: roots_;
+    remove_child(siblings, ptr);
+
+    // children pass to the parent, and inherit from it
+    for (auto child: ptr->children) {
+        child->parent = parent;
+        siblings.push_back(child);
+        if (!child->level_set) {
+            child->level = inherited_level(parent);
+            propagate(child);
+        }
+    }
+    ptr->children.clear();
+    ptr->parent = nullptr;
+}
+
+void facility_manager::propagate(facility_record* ptr) {
+    int level = ptr->level;
+    for (auto child: ptr->children) {
+        if (!child->level_set && child->level!=level) {
+            child->level = level;
+            propagate(child);
+        }
+    }
+}
+
+void facility_manager::set_level(facility_record* ptr, int level) {
+    mex_guard guard(mgr_mex_);
+
+    ptr->level_set = true;
+    ptr->level = level;
+    propagate(ptr);
+}
+
+void facility_manager::inherit_level(facility_record* ptr) {
+    mex_guard guard(mgr_mex_);
+
+    ptr->level_set = false;
+    ptr->level = inherited_level(ptr->parent);
+    propagate(ptr);
+}
+
+facility_record* facility_manager::bind(facility_site* site, const char* name) {
+    facility_record* rec = get(name);
+
+    mex_guard guard(mgr_mex_);
+    if (!site->rec_.load(std::memory_order_relaxed)) {
+        site->next_ = sites_;
+        sites_ = site;
+        site->rec_.store(rec, std::memory_order_release);
+    }
+    return rec;
+}
+
+// counter slots: free slots are kept in a min-heap, so that low slots, with
+// inline shards, are reused first.
 
-    auto i = tbl_.find(name);
-    if (i!=tbl_.end()) {
-        return (i->second).get();
+namespace {
+std::mutex slot_mex;
+std::uint32_t next_counter_slot = 0;                   // guarded by slot_mex
+std::vector<std::uint32_t> free_counter_slots;         // guarded by slot_mex
+
+// set once the thread's slot has been released; a record counted during
+// the remainder of thread teardown takes a fresh slot, never released.
+thread_local bool counter_slot_released = false;
+
+struct counter_slot_holder {
+    ~counter_slot_holder() {
+        std::uint32_t i = impl::counter_slot;
+        if (!i) return;
+
+        impl::counter_slot = 0;
+        counter_slot_released = true;
+
+        mex_guard guard(slot_mex);
+        free_counter_slots.push_back(i-1);
+        std::push_heap(free_counter_slots.begin(), free_counter_slots.end(), std::greater<std::uint32_t>());
+    }
+};
+
+thread_local counter_slot_holder counter_slot_holder_;
+}
+
+thread_local std::uint32_t impl::counter_slot = 0;
+
+std::uint32_t impl::assign_counter_slot() {
+    if (!counter_slot_released) (void)&counter_slot_holder_;  // register release on thread exit
+
+    std::uint32_t i;
+    {
+        mex_guard guard(slot_mex);
+        if (free_counter_slots.empty()) {
+            i = next_counter_slot++;
+        }
+        else {
+            std::pop_heap(free_counter_slots.begin(), free_counter_slots.end(), std::greater<std::uint32_t>());
+            i = free_counter_slots.back();
+            free_counter_slots.pop_back();
+        }
     }
-    else {
-        std::unique_ptr<facility_record> rec(new facility_record);
-        rec->manager = this;
-        rec->name = name;
-        rec->level.store(default_level_);
-        rec->sink = default_sink_;
+    counter_slot = i+1;
+    return i;
+}
+
+constexpr unsigned facility_counters::inline_shards;
+constexpr unsigned facility_counters::n_blocks;
 
-        auto ptr = rec.get();
-        tbl_.insert(std::make_pair(std::string(name), std::move(rec)));
-        return ptr;
+facility_counters::~facility_counters() {
+    for (unsigned j=0; j<n_blocks; ++j) {
+        shard* b = blocks_[j].load(std::memory_order_relaxed);
+        if (!b) continue;
+
+        for (std::size_t k=0; k<(std::size_t(inline_shards)<<j); ++k) b[k].~shard();
+        std::free(b);
     }
 }
 
+facility_counters::shard& facility_counters::block_shard(std::uint32_t i) const {
+    unsigned j = 31-__builtin_clz(i/inline_shards);
+    std::size_t base = std::size_t(inline_shards)<<j;
+
+    shard* b = blocks_[j].load(std::memory_order_acquire);
+    if (!b) {
+        void* p = nullptr;
+        if (::posix_memalign(&p, alignof(shard), base*sizeof(shard))) throw std::bad_alloc();
+
+        shard* fresh = static_cast<shard*>(p);
+        for (std::size_t k=0; k<base; ++k) new (fresh+k) shard;
+
+        if (blocks_[j].compare_exchange_strong(b, fresh, std::memory_order_acq_rel)) b = fresh;
+        else std::free(fresh);   // (shards are trivially destroyed)
+    }
+    return b[i-base];
+}
+
+std::uint64_t facility_counters::total(counter c) const {
+    std::uint64_t t = 0;
+    for (auto& s: shards_) t += s.v[c].load(std::memory_order_relaxed);
+
+    for (unsigned j=0; j<n_blocks; ++j) {
+        const shard* b = blocks_[j].load(std::memory_order_acquire);
+        if (!b) continue;
+
+        for (std::size_t k=0; k<(std::size_t(inline_shards)<<j); ++k) t += b[k].v[c].load(std::memory_order_relaxed);
+    }
+    return t;
+}
+constexpr unsigned latency_histogram::sub_bits;
+constexpr unsigned latency_histogram::sub_buckets;
+constexpr unsigned latency_histogram::n_buckets;
+
+void* facility_record::operator new(std::size_t n) {
+    void* p = nullptr;
+    if (::posix_memalign(&p, alignof(facility_record), n)) throw std::bad_alloc();
+    return p;
+}
+
+void facility_record::operator delete(void* p) {
+    std::free(p);
+}
+
+std::vector<facility_stats> facility_manager::stats() const {
+    std::vector<facility_stats> result;
+    double tps = tsc_clock::ticks_per_second();
+
+    mex_guard guard(mgr_mex_);
+    for (auto& rec: records_) {
+        const facility_counters& c = rec->counters;
+        std::uint64_t filtered = c.total(facility_counters::filtered);
+
+        result.push_back(facility_stats{
+            rec->name.load(),
+            filtered+c.total(facility_counters::completed),
+            filtered,
+            c.total(facility_counters::emitted),
+            c.total(facility_counters::bytes),
+            c.total(facility_counters::sink_ticks)/tps});
+    }
+    return result;
+}
+
 void facility_manager::level(int level) {
     mex_guard guard(mgr_mex_);
 
     default_level_ = level;
-    for (auto& entry: tbl_) {
-        entry.second->level = level;
+    for (auto& rec: records_) {
+        rec->level_set = false;
+        rec->level = level;
+    }
+}
+
+void facility_manager::root_level(int level) {
+    mex_guard guard(mgr_mex_);
+
+    default_level_ = level;
+    for (auto rec: roots_) {
+        if (!rec->level_set && rec->level!=level) {
+            rec->level = level;
+            propagate(rec);
+        }
     }
 }
 
@@ -47,20 +353,97 @@ void facility_manager::default_sink(log_sink_t sink) {
     default_sink_ = std::move(sink);
 }
 
-// note: O(n) for n facilities
+// the old name remains valid: sinks may yet be using it.
 void facility_manager::rename(facility_record* ptr, const char* name) {
     mex_guard guard(mgr_mex_);
 
-    auto i = tbl_.begin();
-    for (; i!=tbl_.end() && i->second.get()!=ptr; ++i) {}
+    // (the new place, and the level inherited there, are found before the
+    // record is published under the new name)
+    unlink(ptr);
+    facility_record* parent = ancestor(name);
+    if (!ptr->level_set) ptr->level = inherited_level(parent);
+    tbl_.erase(ptr->name, ptr);
+    ptr->name = tbl_.insert(name, ptr);
+    link(ptr, parent);
+
+    // unbind call sites that resolved the old name to this facility
+    for (facility_site** p = &sites_; *p; ) {
+        facility_site* site = *p;
+        if (site->rec_.load(std::memory_order_relaxed)==ptr) {
+            site->rec_.store(nullptr, std::memory_order_release);
+            *p = site->next_;
+            site->next_ = nullptr;
+        }
+        else {
+            p = &site->next_;
+        }
+    }
+}
+
+// call site registry
+
+namespace {
+std::mutex site_mex;
+facility_site* registered_sites = nullptr;  // guarded by site_mex
+
+// sites outlive managers: they keep their facility names here
+std::set<std::string>& site_names() {
+    static std::set<std::string> names;
+    return names;
+}
+
+bool glob_match(const char* pattern, const char* s) {
+    return !pattern || (s && !::fnmatch(pattern, s, 0));
+}
+
+bool site_matches(const facility_site& site, const site_query& q) {
+    source_location loc = site.location();
+    const char* file = loc.file? loc.file: "";
+    return (glob_match(q.file, file) || glob_match(q.file, stream_sink::basename(file))) &&
+        (!q.line || q.line==loc.line) &&
+        glob_match(q.func, loc.func) &&
+        glob_match(q.facility, site.facility_name());
+}
+}
+
+constexpr std::int8_t facility_site::unregistered;
+
+void facility_site::enroll(const facility_record* rec, source_location loc) {
+    std::lock_guard<std::mutex> guard(site_mex);
+    if (override_.load(std::memory_order_relaxed)!=unregistered) return;
 
-    if (i!=tbl_.end()) {
-        std::unique_ptr<facility_record> rec(std::move(i->second));
-        tbl_.erase(i);
-        rec->name = name;
-        tbl_.insert(std::make_pair(std::string(name), std::move(rec)));
+    loc_ = loc;
+    facility_ = site_names().insert(rec->name.load()).first->c_str();
+    next_registered_ = registered_sites;
+    registered_sites = this;
+    override_.store(static_cast<std::int8_t>(site_override::none), std::memory_order_relaxed);
+}
+
+std::size_t set_site_override(const site_query& q, site_override o) {
+    std::lock_guard<std::mutex> guard(site_mex);
+
+    std::size_t n = 0;
+    for (facility_site* site = registered_sites; site; site = site->next_registered_) {
+        if (site_matches(*site, q)) {
+            site->override_.store(static_cast<std::int8_t>(o), std::memory_order_relaxed);
+            ++n;
+        }
     }
+    return n;
 }
 
+// sites are never unregistered, and their descriptors do not change once
+// registered: `f` is called without the lock held, so that it may log.
+void for_each_site(const std::function<void (const facility_site&)>& f) {
+    facility_site* first;
+    {
+        std::lock_guard<std::mutex> guard(site_mex);
+        first = registered_sites;
+    }
+
+    for (facility_site* site = first; site; site = site->next_registered_) {
+        f(*site);
+    }
+}
 
 } // namespace log
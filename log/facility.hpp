@@ -1,11 +1,23 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <ostream>
 #include <sstream>
-#include <unordered_map>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <log/clock.hpp>
+#include <log/epoch.hpp>
+#include <log/facility_table.hpp>
+#include <log/fields.hpp>
+#include <log/histogram.hpp>
 
 namespace log {
 
@@ -26,22 +38,51 @@ struct log_entry {
     int level;                // log message level
     source_location location; // source info if provided
     const char* message;      // log message
+    timestamp time;           // time of record creation; zero ticks if absent
+    std::uint32_t thread;     // `thread_index()` of the logging thread
+    std::uint64_t sequence;   // per-manager record sequence number
+    const log_field* fields;  // key/value fields, if any
+    std::size_t n_fields;
 };
 
 using log_sink_t = std::function<void (const log_entry&)>;
 
+// snapshot of a facility's counters (see `facility_manager::stats`)
+
+struct facility_stats {
+    std::string name;
+    std::uint64_t attempted;   // records tested against the facility level
+    std::uint64_t filtered;    // records discarded by the level test or site override
+    std::uint64_t emitted;     // records passed to a sink
+    std::uint64_t bytes;       // message bytes passed to a sink
+    double sink_seconds;       // time spent in the sink
+};
+
 // `facility_manager` maintains a collection of log facilities
 
 struct facility_record;
+class facility_site;
+
+// deferred-formatting hook (see log/binary.hpp): wait until the records
+// queued for the backend have been handled, if it has been started.
+void binary_drain();
 
 class facility_manager {
 private:
+    // guards modification of the table and manager state; lookups of
+    // existing facilities by name do not take the lock.
     mutable std::mutex mgr_mex_;
 
-    std::unordered_multimap<std::string, std::unique_ptr<facility_record>> tbl_;
+    facility_table tbl_;
+    std::vector<std::unique_ptr<facility_record>> records_;
+    std::vector<facility_record*> roots_;  // records with no ancestor
+    facility_site* sites_ = nullptr;
     std::atomic<int> default_level_;
     log_sink_t default_sink_;
 
+    std::atomic<clock_source> clock_{clock_source::realtime};
+    std::atomic<std::uint64_t> sequence_{0};
+
 public:
     facility_manager():
         default_level_(0), default_sink_([](const log_entry&) {}) {}
@@ -55,26 +96,66 @@ public:
 
     facility_manager(facility_manager&&) = default;
 
-    // default level for new facilities
+    // queued deferred-formatting records refer to the facility records, so
+    // are handled before these are freed
+    ~facility_manager();
+
+    // root level, inherited by facilities with no level set on themselves
+    // or an ancestor
+    int root_level() const { return default_level_; }
     int level() const { return default_level_; }
 
-    // set level (and default level) for all facilities
+    // set level (and root level) for all facilities, discarding levels set
+    // on individual facilities
     void level(int);
 
+    // set the root level only
+    void root_level(int);
+
     // default sink for new facilities
     log_sink_t default_sink() const;
 
     // set default sink for new facilities
     void default_sink(log_sink_t sink);
 
+    // clock used to timestamp records
+    clock_source clock() const { return clock_.load(std::memory_order_relaxed); }
+
+    // set clock used to timestamp records
+    void clock(clock_source c) {
+        if (c==clock_source::tsc) tsc_clock::calibrate();
+        clock_.store(c, std::memory_order_relaxed);
+    }
+
+    // claim the next record sequence number
+    std::uint64_t next_sequence() { return sequence_.fetch_add(1, std::memory_order_relaxed); }
+
+    // counters of each facility, in order of creation
+    std::vector<facility_stats> stats() const;
+
 private:
     friend class facility;
+    friend class facility_site;
 
-    // rename entry (O(n) for n facilities)
+    // rename entry
     void rename(facility_record* ptr, const char* name);
 
+    // set the level of a facility, or have it inherit its parent's again
+    void set_level(facility_record* ptr, int level);
+    void inherit_level(facility_record* ptr);
+
+    // maintenance of the name hierarchy, with the lock held
+    facility_record* ancestor(const char* name);
+    int inherited_level(const facility_record* parent) const;
+    void link(facility_record* ptr, facility_record* parent);
+    void unlink(facility_record* ptr);
+    void propagate(facility_record* ptr);
+
     // retrieve or create facility data
     facility_record* get(const char* name);
+
+    // retrieve or create facility data and bind it to a call site
+    facility_record* bind(facility_site* site, const char* name);
 };
 
 
@@ -82,40 +163,369 @@ private:
 
 extern facility_manager g_facility_manager;
 
+// counter slot of the calling thread: a small integer held by one live
+// thread at a time, and reused by a later thread once the holder exits.
+
+namespace impl {
+    extern thread_local std::uint32_t counter_slot;  // slot+1; zero until assigned
+    std::uint32_t assign_counter_slot();
+}
+
+inline std::uint32_t counter_slot() {
+    std::uint32_t i = impl::counter_slot;
+    return i? i-1: impl::assign_counter_slot();
+}
+
+// `facility_counters` keeps the counters of a facility, sharded by thread:
+// the thread holding counter slot `i` owns cache-line aligned shard `i`,
+// which it updates with plain loads and stores. Shards for the first
+// `inline_shards` slots are held inline; those for higher slots in blocks
+// of doubling size, allocated when first used. Counting a discarded record
+// thus writes only to a line of the counting thread's own.
+
+class facility_counters {
+public:
+    static constexpr unsigned inline_shards = 16;
+
+    enum counter: unsigned { filtered, completed, emitted, bytes, sink_ticks, n_counters };
+
+    facility_counters() {
+        for (auto& b: blocks_) b.store(nullptr, std::memory_order_relaxed);
+    }
+
+    facility_counters(const facility_counters&) = delete;
+    facility_counters& operator=(const facility_counters&) = delete;
+
+    ~facility_counters();
+
+    void count_filtered() const {
+        add(local(), filtered, 1);
+    }
+
+    // a completed record, and whether and for how long it was passed to a sink
+    void count_record(bool sunk, std::uint64_t n_bytes, std::uint64_t ticks) const {
+        shard& s = local();
+        add(s, completed, 1);
+        if (sunk) count_emitted(s, n_bytes, ticks);
+    }
+
+    // a record passed to a sink by backfill, having been counted as filtered
+    void count_backfilled(std::uint64_t n_bytes, std::uint64_t ticks) const {
+        count_emitted(local(), n_bytes, ticks);
+    }
+
+    std::uint64_t total(counter c) const;
+
+private:
+    struct alignas(64) shard {
+        std::atomic<std::uint64_t> v[n_counters];
+        shard() { for (auto& x: v) x.store(0, std::memory_order_relaxed); }
+    };
+
+    // block `j` holds the shards of slots `inline_shards<<j` up to
+    // `inline_shards<<(j+1)`.
+    static constexpr unsigned n_blocks = 24;
+
+    mutable shard shards_[inline_shards];
+    mutable std::atomic<shard*> blocks_[n_blocks];
+
+    shard& local() const {
+        std::uint32_t i = counter_slot();
+        return i<inline_shards? shards_[i]: block_shard(i);
+    }
+
+    shard& block_shard(std::uint32_t i) const;
+
+    static void count_emitted(shard& s, std::uint64_t n_bytes, std::uint64_t ticks) {
+        add(s, emitted, 1);
+        add(s, bytes, n_bytes);
+        add(s, sink_ticks, ticks);
+    }
+
+    static void add(shard& s, counter c, std::uint64_t n) {
+        std::atomic<std::uint64_t>& x = s.v[c];
+        x.store(x.load(std::memory_order_relaxed)+n, std::memory_order_relaxed);
+    }
+};
+
+// backfill hooks (see log/backfill.hpp): keep a record discarded by the
+// facility level in the calling scope's ring; pass the records held for a
+// facility in the calling scope to `sink`, oldest first; release the
+// backfill configuration of a facility being destroyed.
+
+struct facility_record;
+void backfill_store(const facility_record* rec, const log_entry& entry);
+void backfill_flush(const facility_record* rec, const log_sink_t* sink);
+void backfill_retire(const facility_record* rec);
+
 // facility semantics are determined by their `facility_record` data;
 // pointers to `facility_record` data provided by a `facility_manager` instance
-// have the same lifetime as that instance.
+// have the same lifetime as that instance, as do the facility names: the
+// manager keeps its own copy of each name a facility has been given.
 
 struct facility_record {
     facility_manager* manager;
     std::atomic<const char*> name;
-    std::atomic<int> level;
+    std::atomic<int> level;    // effective level, set or inherited
+
+    // current sink, read within an `epoch_guard`; replaced sinks are
+    // retired with `epoch_retire`.
+    std::atomic<const log_sink_t*> sink{nullptr};
+
+    // backfill mode: with non-zero depth, records discarded by the level
+    // are kept, up to `backfill_depth` per scope, and passed to the sink
+    // ahead of the next record at or below `backfill_trigger` from the same
+    // scope. The generation distinguishes successive configurations. (Kept
+    // on the cache line of `level`, which the discarding path reads.)
+    std::atomic<unsigned> backfill_depth{0};
+    std::atomic<int> backfill_trigger{0};
+    std::atomic<std::uint64_t> backfill_generation{0};
+
+    facility_counters counters;
+
+    // sink latency histogram, if enabled; read within an `epoch_guard`, and
+    // retired with `epoch_retire` when disabled.
+    std::atomic<latency_histogram*> latency{nullptr};
+
+    // place in the name hierarchy, guarded by the manager mutex: the nearest
+    // existing ancestor by dotted name, the records of which this is the
+    // nearest ancestor, and whether `level` was set rather than inherited.
+    facility_record* parent = nullptr;
+    std::vector<facility_record*> children;
+    bool level_set = false;
+
+    bool backfills() const { return backfill_depth.load(std::memory_order_relaxed); }
+
+    ~facility_record() {
+        if (backfill_generation.load(std::memory_order_relaxed)) backfill_retire(this);
+        delete sink.load();
+        delete latency.load();
+    }
+
+    // allocated with the alignment of the counter shards
+    static void* operator new(std::size_t n);
+    static void operator delete(void* p);
+
+    // pass a completed record of `bytes` message bytes to the current sink
+    void emit(const log_entry& entry, std::size_t bytes) const {
+        epoch_guard guard;
+        const log_sink_t* s = sink.load(std::memory_order_acquire);
+        if (backfills() && entry.level<=backfill_trigger.load(std::memory_order_relaxed)) {
+            backfill_flush(this, s);
+        }
+        if (s && *s) {
+            counters.count_record(true, bytes, call_sink(*s, entry));
+        }
+        else {
+            counters.count_record(false, 0, 0);
+        }
+    }
+
+    // pass a record to sink `s` and record the latency; returns the ticks taken
+    std::uint64_t call_sink(const log_sink_t& s, const log_entry& entry) const {
+        std::uint64_t t0 = tsc_clock::now();
+        s(entry);
+        std::uint64_t dt = tsc_clock::now()-t0;
+
+        if (latency_histogram* h = latency.load(std::memory_order_acquire)) h->record(dt);
+        return dt;
+    }
+};
+
+// per-call-site override of the facility level test
 
-    mutable std::mutex sink_mex;
-    log_sink_t sink;
+enum class site_override: std::int8_t {
+    none = 0,      // records are admitted by facility level
+    enable = 1,    // all records are admitted
+    disable = -1   // no records are admitted
 };
 
-// stream class for collecting log record information
+struct site_query;
+
+// `facility_site` is the static descriptor of a single logging call site
+// (see `LOG2`). It caches the facility record looked up by name, so that
+// subsequent executions need not consult the manager; the manager unbinds
+// sites when the facility they refer to is renamed.
+//
+// On first execution, the site records its source location and facility
+// name and registers itself in a global list of call sites, through which
+// its `site_override` can be listed and changed at run time (see
+// `set_site_override`). The override is a single byte, loaded alongside the
+// facility level test; until registration, it holds a value outside
+// `site_override` that diverts the test to the registration path.
+
+class facility_site {
+public:
+    constexpr facility_site() {}
+
+    facility_site(const facility_site&) = delete;
+    facility_site& operator=(const facility_site&) = delete;
+
+    facility_record* record(const char* name, facility_manager& mgr = g_facility_manager) {
+        facility_record* rec = rec_.load(std::memory_order_acquire);
+        return rec? rec: mgr.bind(this, name);
+    }
+
+    // true if a record at `level` from this site is admitted by facility `rec`;
+    // registers the site with location `loc` on first call.
+    bool admits(int level, const facility_record* rec, source_location loc) {
+        std::int8_t o = override_.load(std::memory_order_relaxed);
+        if (!o) return level<=rec->level.load(std::memory_order_relaxed);
+        if (o!=unregistered) return o>0;
+
+        enroll(rec, loc);
+        return admits(level, rec, loc);
+    }
+
+    // descriptor of a registered site
+    source_location location() const { return loc_; }
+    const char* facility_name() const { return facility_; }
+
+    site_override enable_override() const {
+        std::int8_t o = override_.load(std::memory_order_relaxed);
+        return o==unregistered? site_override::none: static_cast<site_override>(o);
+    }
+
+private:
+    friend class facility_manager;
+    friend std::size_t set_site_override(const site_query&, site_override);
+    friend void for_each_site(const std::function<void (const facility_site&)>&);
+
+    static constexpr std::int8_t unregistered = 2;
+
+    std::atomic<facility_record*> rec_{nullptr};
+    std::atomic<std::int8_t> override_{unregistered};
+    facility_site* next_ = nullptr;  // guarded by manager mutex
+
+    // set on registration, under the registry lock
+    source_location loc_ = no_source_location;
+    const char* facility_ = nullptr;
+    facility_site* next_registered_ = nullptr;
+
+    void enroll(const facility_record* rec, source_location loc);
+};
+
+// selects registered call sites: each pattern is a shell wildcard pattern
+// (as for `fnmatch`), or null to match anything. `file` is matched against
+// both the path and its last component; `func` against the function name as
+// given by `__PRETTY_FUNCTION__`; `facility` against the facility name the
+// site had when registered. A `line` of zero matches any line.
+
+struct site_query {
+    const char* file = nullptr;
+    int line = 0;
+    const char* func = nullptr;
+    const char* facility = nullptr;
+};
+
+// set the override of the registered call sites matching `q`; returns the
+// number of sites matched.
+std::size_t set_site_override(const site_query& q, site_override o);
+
+// call `f` with each registered call site, most recently registered first.
+void for_each_site(const std::function<void (const facility_site&)>& f);
+
+// growable character buffer for composing log record text; buffers are
+// drawn from a per-thread pool and reused, so that the steady-state cost of
+// composing a record involves no heap allocation.
+
+class record_buf: public std::streambuf {
+public:
+    record_buf(): buf_(initial_size) { reset(); }
+
+    record_buf(const record_buf&) = delete;
+    record_buf& operator=(const record_buf&) = delete;
+
+    // discard buffer contents and fields, retaining storage
+    void reset() {
+        setp(buf_.data(), buf_.data()+buf_.size()-1);
+        fields_.clear();
+    }
+
+    // NUL-terminated buffer contents
+    const char* c_str() {
+        *pptr() = 0;
+        return pbase();
+    }
+
+    std::size_t size() const { return pptr()-pbase(); }
+    std::size_t capacity() const { return buf_.size(); }
+
+    // key/value fields of the record
+    field_store& fields() { return fields_; }
+
+    // obtain a buffer from the calling thread's pool
+    static record_buf* acquire();
+
+    // return a buffer to the calling thread's pool
+    static void release(record_buf* buf);
+
+protected:
+    int_type overflow(int_type c) override {
+        if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+
+        grow(1);
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+        return c;
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        if (n>epptr()-pptr()) grow(n);
+
+        traits_type::copy(pptr(), s, n);
+        pbump(static_cast<int>(n));
+        return n;
+    }
+
+private:
+    static constexpr std::size_t initial_size = 256;
+    std::vector<char> buf_;
+    field_store fields_;
+
+    void grow(std::streamsize n) {
+        std::size_t used = size();
+        std::size_t want = used+n+1;
+        std::size_t sz = buf_.size();
+        while (sz<want) sz *= 2;
+
+        buf_.resize(sz);
+        setp(buf_.data(), buf_.data()+sz-1);
+        pbump(static_cast<int>(used));
+    }
+};
+
+// stream class for collecting log record information; the record is
+// timestamped and sequenced on construction.
 
 class sink_stream: public std::ostream {
     const facility_record* data_;
+    bool backfill_;  // keep for backfill rather than emit
     int level_;
     source_location loc_;
+    timestamp time_;
+    std::uint32_t thread_;
+    std::uint64_t sequence_;
 
 public:
-    sink_stream(const facility_record* data, int level):
-        std::ostream(new std::stringbuf),
-        data_(data), level_(level), loc_(no_source_location)
+    sink_stream(const facility_record* data, int level, bool backfill = false):
+        std::ostream(record_buf::acquire()),
+        data_(data), backfill_(backfill), level_(level), loc_(no_source_location),
+        time_(read_clock(data->manager->clock())),
+        thread_(thread_index()),
+        sequence_(data->manager->next_sequence())
     {}
 
     sink_stream():
         std::ostream(nullptr),
-        data_(nullptr), level_(0), loc_(no_source_location)
+        data_(nullptr), backfill_(false), level_(0), loc_(no_source_location),
+        time_{clock_source::realtime, 0}, thread_(0), sequence_(0)
     {}
 
     sink_stream(sink_stream&& them):
         std::ostream(std::move(them)),
-        data_(them.data_), level_(them.level_), loc_(them.loc_)
+        data_(them.data_), backfill_(them.backfill_), level_(them.level_), loc_(them.loc_),
+        time_(them.time_), thread_(them.thread_), sequence_(them.sequence_)
     {
         rdbuf(them.rdbuf());
         them.rdbuf(nullptr);
@@ -129,17 +539,21 @@ public:
         loc_ = loc;
     }
 
+    void add_field(const log_field& f) {
+        if (auto buf = dynamic_cast<record_buf*>(rdbuf())) buf->fields().add(f);
+    }
+
     ~sink_stream() {
-        std::stringbuf *buf = dynamic_cast<std::stringbuf*>(rdbuf());
+        record_buf* buf = dynamic_cast<record_buf*>(rdbuf());
         if (buf && data_) {
-            log_sink_t sink;
-            {
-                std::lock_guard<std::mutex> guard(data_->sink_mex);
-                sink = data_->sink;
-            }
-            if (sink) sink(log_entry{data_->name, level_, loc_, buf->str().c_str()});
+            const field_store& fields = buf->fields();
+            log_entry entry{data_->name, level_, loc_, buf->c_str(), time_, thread_, sequence_,
+                fields.data(), fields.size()};
+
+            if (backfill_) backfill_store(data_, entry);
+            else data_->emit(entry, buf->size());
         }
-        delete buf;
+        if (buf) record_buf::release(buf);
     }
 };
 
@@ -156,14 +570,17 @@ inline std::ostream& operator<<(std::ostream& out, const source_location& loc) {
     return out;
 }
 
-// `log_test_proxy` is used by the LOG macro to test if a `sink_stream` is
-// *not* valid
+// as are key/value fields; elsewhere they are written as `key=value`
 
-struct log_test_proxy {
-    explicit log_test_proxy(sink_stream&& s): stream(std::move(s)) {}
-    operator bool() const { return !stream; }
-    sink_stream stream;
-};
+inline std::ostream& operator<<(std::ostream& out, const log_field& f) {
+    if (auto s = dynamic_cast<sink_stream*>(&out)) {
+        s->add_field(f);
+    }
+    else {
+        format_field(f, [&out](const char* p, std::size_t n) { out.write(p, n); });
+    }
+    return out;
+}
 
 // logging facility
 
@@ -172,7 +589,10 @@ class facility {
 
 public:
     sink_stream operator()(int lev) {
-        return lev<=data_->level? sink_stream(data_, lev): sink_stream();
+        if (lev<=data_->level) return sink_stream(data_, lev);
+
+        data_->counters.count_filtered();
+        return data_->backfills()? sink_stream(data_, lev, true): sink_stream();
     }
 
     template <typename T>
@@ -185,23 +605,138 @@ public:
     explicit facility(const char* name, facility_manager& mgr = g_facility_manager):
         data_(mgr.get(name)) {}
 
+    explicit facility(facility_record* data): data_(data) {}
+
     facility(const facility&) = default;
     facility& operator=(const facility&) = default;
 
     const char* name() const { return data_->name; }
     void name(const char* name) { data_->manager->rename(data_, name); }
 
+    facility_record* record() const { return data_; }
+
+    // effective level: the level set on this facility or, failing that, on
+    // its nearest ancestor by dotted name (`solver` for `solver.linear.cg`),
+    // or the manager's root level.
     int level() const { return data_->level; }
-    void level(int lev) { data_->level = lev; }
+
+    // set the level of this facility and of descendants that inherit it
+    void level(int lev) { data_->manager->set_level(data_, lev); }
+
+    // inherit the level again
+    void inherit_level() { data_->manager->inherit_level(data_); }
 
     log_sink_t sink() const {
-        std::lock_guard<std::mutex> guard(data_->sink_mex);
-        return data_->sink;
+        epoch_guard guard;
+        const log_sink_t* sink = data_->sink.load(std::memory_order_acquire);
+        return sink? *sink: log_sink_t();
     }
     void sink(log_sink_t sink) const {
-        std::lock_guard<std::mutex> guard(data_->sink_mex);
-        data_->sink = std::move(sink);
+        const log_sink_t* old = data_->sink.exchange(new log_sink_t(std::move(sink)), std::memory_order_acq_rel);
+        if (old) epoch_retire(old);
+    }
+
+    // enable or disable the histogram of sink call latencies; enabling
+    // starts from an empty histogram.
+    void track_latency(bool on) const {
+        latency_histogram* h = on? new latency_histogram: nullptr;
+        latency_histogram* old = data_->latency.exchange(h, std::memory_order_acq_rel);
+        if (old) epoch_retire(old);
+    }
+
+    bool tracks_latency() const {
+        return data_->latency.load(std::memory_order_relaxed);
+    }
+
+    // keep up to `depth` discarded records per thread or `backfill_scope`,
+    // to be emitted before the next record at or below `trigger` level from
+    // the same scope; a depth of zero disables backfill.
+    void backfill(unsigned depth, int trigger) const;
+
+    unsigned backfill_depth() const { return data_->backfill_depth.load(std::memory_order_relaxed); }
+
+    // sink latency percentiles since enabled or last reset; zero if disabled
+    latency_summary latency() const {
+        epoch_guard guard;
+        const latency_histogram* h = data_->latency.load(std::memory_order_acquire);
+        return h? h->summary(tsc_clock::ticks_per_second()): latency_summary{0, 0, 0, 0, 0};
     }
+
+    // clear the latency histogram, without disturbing concurrent loggers
+    void reset_latency() const {
+        epoch_guard guard;
+        if (latency_histogram* h = data_->latency.load(std::memory_order_acquire)) h->reset();
+    }
+
+private:
+    friend struct log_test_proxy;
 };
 
+// `log_test_proxy` is used by the LOG macro to test if a record at the given
+// level would be *discarded* by a facility, or by the call site's override;
+// the `sink_stream` is constructed only if it would not. A record refused by
+// the level test of a facility in backfill mode is not discarded, but kept
+// for backfill (unless the site override disables it): `data` is then null
+// and `backfill` is set.
+
+struct log_test_proxy {
+    log_test_proxy(const facility& fac, int level):
+        data(level<=fac.data_->level? fac.data_: nullptr), backfill(nullptr), level(level)
+    {
+        if (!data) refused(fac.data_, true);
+    }
+
+    log_test_proxy(const facility& fac, int level, facility_site& site, source_location loc):
+        data(site.admits(level, fac.data_, loc)? fac.data_: nullptr), backfill(nullptr), level(level)
+    {
+        if (!data) refused(fac.data_, site.enable_override()!=site_override::disable);
+    }
+
+    operator bool() const { return !data && !backfill; }
+    sink_stream stream() const { return data? sink_stream(data, level): sink_stream(backfill, level, true); }
+
+    const facility_record* data;
+    const facility_record* backfill;
+    int level;
+
+private:
+    void refused(const facility_record* rec, bool keep) {
+        rec->counters.count_filtered();
+        if (keep && rec->backfills()) backfill = rec;
+    }
+};
+
+// `site_facility` resolves the facility argument of the LOG macro: a name
+// written as a string literal is looked up once per call site and cached in
+// `site`; any other argument is converted to a facility directly. The macro
+// tells a literal by the spelling of the argument (`Literal`), since a
+// `const char` array need not hold a constant name.
+
+inline facility site_facility(const char* name, facility_site& site, std::true_type) {
+    return facility(site.record(name));
+}
+
+template <typename Fac>
+facility site_facility(Fac&& fac, facility_site&, std::false_type) {
+    return facility(std::forward<Fac>(fac));
+}
+
+template <bool Literal, typename Fac>
+facility site_facility(Fac&& fac, facility_site& site) {
+    using type = typename std::remove_reference<Fac>::type;
+    using is_literal = std::integral_constant<bool, Literal &&
+        std::is_array<type>::value &&
+        std::is_same<typename std::remove_extent<type>::type, const char>::value>;
+
+    return site_facility(std::forward<Fac>(fac), site, is_literal{});
+}
+
+// the test made by the LOG macro: resolve the facility through the call
+// site, then apply the facility level and site override.
+
+template <bool Literal, typename Fac>
+log_test_proxy site_test(Fac&& fac, int level, facility_site& site, source_location loc) {
+    return log_test_proxy(site_facility<Literal>(std::forward<Fac>(fac), site), level, site, loc);
+}
+
 } // namespace log
@@ -0,0 +1,115 @@
+#include <cstring>
+
+#include <log/facility_table.hpp>
+
+namespace log {
+
+namespace {
+constexpr std::size_t initial_buckets = 64;
+}
+
+facility_table::bucket_array::bucket_array(std::size_t n):
+    size(n), buckets(new std::atomic<entry*>[n])
+{
+    for (std::size_t i=0; i<n; ++i) {
+        buckets[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+facility_table::facility_table() {
+    arrays_.emplace_back(new bucket_array(initial_buckets));
+    buckets_.store(arrays_.back().get(), std::memory_order_release);
+}
+
+facility_table::~facility_table() {}
+
+// FNV-1a
+std::size_t facility_table::hash(const char* name) {
+    std::size_t h = 14695981039346656037ull;
+    while (*name) {
+        h ^= static_cast<unsigned char>(*name++);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+facility_record* facility_table::find(const char* name) const {
+    std::size_t h = hash(name);
+    const bucket_array* a = buckets_.load(std::memory_order_acquire);
+
+    for (entry* e = a->buckets[h%a->size].load(std::memory_order_acquire);
+         e; e = e->next.load(std::memory_order_acquire))
+    {
+        if (e->hash!=h || std::strcmp(e->name, name)) continue;
+        if (auto rec = e->rec.load(std::memory_order_acquire)) return rec;
+    }
+    return nullptr;
+}
+
+facility_table::entry* facility_table::make_entry(std::size_t h, const char* name, facility_record* rec) {
+    std::unique_ptr<entry> e(new entry);
+    e->hash = h;
+    e->name = name;
+    e->rec.store(rec, std::memory_order_relaxed);
+    e->next.store(nullptr, std::memory_order_relaxed);
+
+    entries_.push_back(std::move(e));
+    return entries_.back().get();
+}
+
+void facility_table::link(bucket_array& a, entry* e) {
+    auto& head = a.buckets[e->hash%a.size];
+    e->next.store(head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    head.store(e, std::memory_order_release);
+}
+
+const char* facility_table::insert(const char* name, facility_record* rec) {
+    std::size_t n = std::strlen(name)+1;
+    names_.emplace_back(new char[n]);
+    char* owned = names_.back().get();
+    std::memcpy(owned, name, n);
+
+    if (count_>=buckets_.load(std::memory_order_relaxed)->size) grow();
+
+    link(*buckets_.load(std::memory_order_relaxed), make_entry(hash(owned), owned, rec));
+    ++count_;
+    return owned;
+}
+
+void facility_table::erase(const char* name, const facility_record* rec) {
+    std::size_t h = hash(name);
+    bucket_array* a = buckets_.load(std::memory_order_relaxed);
+
+    for (entry* e = a->buckets[h%a->size].load(std::memory_order_relaxed);
+         e; e = e->next.load(std::memory_order_relaxed))
+    {
+        if (e->rec.load(std::memory_order_relaxed)==rec) {
+            e->rec.store(nullptr, std::memory_order_release);
+            --count_;
+            return;
+        }
+    }
+}
+
+// Live entries are copied into a new, larger bucket array, which is then
+// published; lookups already in progress continue over the old array, which
+// is left untouched from then on.
+void facility_table::grow() {
+    bucket_array* old = buckets_.load(std::memory_order_relaxed);
+    std::unique_ptr<bucket_array> a(new bucket_array(2*old->size));
+
+    for (std::size_t i=0; i<old->size; ++i) {
+        for (entry* e = old->buckets[i].load(std::memory_order_relaxed);
+             e; e = e->next.load(std::memory_order_relaxed))
+        {
+            if (auto rec = e->rec.load(std::memory_order_relaxed)) {
+                link(*a, make_entry(e->hash, e->name, rec));
+            }
+        }
+    }
+
+    arrays_.push_back(std::move(a));
+    buckets_.store(arrays_.back().get(), std::memory_order_release);
+}
+
+} // namespace log
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace log {
+
+struct facility_record;
+
+// `facility_table` maps facility names to facility records.
+//
+// Lookups are lock-free and do not allocate; insertions and removals must be
+// serialized by the caller. Entries are never modified once visible except to
+// be marked dead, and neither entries, names nor superseded bucket arrays are
+// freed before the table itself, so a concurrent lookup never touches freed
+// memory. A lookup racing with an insertion may miss the new entry.
+
+class facility_table {
+public:
+    facility_table();
+    ~facility_table();
+
+    facility_table(const facility_table&) = delete;
+    facility_table& operator=(const facility_table&) = delete;
+
+    // live record with the given name, or nullptr (lock-free)
+    facility_record* find(const char* name) const;
+
+    // add entry for record; returns the table-owned copy of name
+    const char* insert(const char* name, facility_record* rec);
+
+    // mark entry for record under the given name as dead
+    void erase(const char* name, const facility_record* rec);
+
+private:
+    struct entry {
+        std::size_t hash;
+        const char* name;
+        std::atomic<facility_record*> rec;
+        std::atomic<entry*> next;
+    };
+
+    struct bucket_array {
+        explicit bucket_array(std::size_t n);
+
+        std::size_t size;
+        std::unique_ptr<std::atomic<entry*>[]> buckets;
+    };
+
+    std::atomic<bucket_array*> buckets_;
+    std::size_t count_ = 0;
+
+    // storage retained for the lifetime of the table
+    std::vector<std::unique_ptr<entry>> entries_;
+    std::vector<std::unique_ptr<bucket_array>> arrays_;
+    std::vector<std::unique_ptr<char[]>> names_;
+
+    static std::size_t hash(const char* name);
+
+    entry* make_entry(std::size_t h, const char* name, facility_record* rec);
+    void link(bucket_array& a, entry* e);
+    void grow();
+};
+
+} // namespace log
@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <log/clock.hpp>
+#include <log/fd_sink.hpp>
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+namespace log {
+
+constexpr std::size_t fd_sink::buffer_size;
+
+// Pending output is a sequence of `iovec` segments, referring either to the
+// buffer or, until the end of the current sink call, to message text in
+// place. Buffer contents not yet covered by a segment run from `seg_begin`
+// to `used`.
+
+struct fd_sink::state {
+    std::mutex mex;
+    int fd = -1;
+
+    bool flush = true;
+    bool abort = false;
+    bool emitloc = true;
+    bool emitfac = false;
+    bool emittime = false;
+    bool emitthread = false;
+    bool emitseq = false;
+    bool emitfields = true;
+
+    std::unique_ptr<char[]> buf{new char[buffer_size]};
+    std::size_t used = 0;
+    std::size_t seg_begin = 0;
+    std::vector<iovec> iov;
+    bool external = false; // a segment refers to data outside the buffer
+
+    ~state() {
+        submit();
+        if (fd>=0) ::close(fd);
+    }
+
+    void close_segment() {
+        if (used>seg_begin) {
+            iov.push_back(iovec{buf.get()+seg_begin, used-seg_begin});
+            seg_begin = used;
+        }
+    }
+
+    void submit() {
+        close_segment();
+
+        std::size_t i = 0;
+        while (i<iov.size()) {
+            int cnt = static_cast<int>(std::min<std::size_t>(iov.size()-i, IOV_MAX));
+            ssize_t w = ::writev(fd, &iov[i], cnt);
+            if (w<0) {
+                if (errno==EINTR) continue;
+                break; // nothing sensible to do with the remainder
+            }
+
+            std::size_t n = w;
+            while (n && i<iov.size()) {
+                if (n>=iov[i].iov_len) {
+                    n -= iov[i].iov_len;
+                    ++i;
+                }
+                else {
+                    iov[i].iov_base = static_cast<char*>(iov[i].iov_base)+n;
+                    iov[i].iov_len -= n;
+                    n = 0;
+                }
+            }
+        }
+
+        iov.clear();
+        used = seg_begin = 0;
+        external = false;
+    }
+
+    // reference `s` in place; it must remain valid until the next `submit`.
+    void put_ref(const char* s, std::size_t n) {
+        if (!n) return;
+        if (iov.size()+2>=IOV_MAX) submit();
+
+        close_segment();
+        iov.push_back(iovec{const_cast<char*>(s), n});
+        external = true;
+    }
+
+    void put(const char* s, std::size_t n) {
+        if (used+n>buffer_size) {
+            submit();
+            if (n>buffer_size) return put_ref(s, n);
+        }
+        std::memcpy(buf.get()+used, s, n);
+        used += n;
+    }
+
+    void put(const char* s) { put(s, std::strlen(s)); }
+
+    void put(char c) {
+        if (used+1>buffer_size) submit();
+        buf[used++] = c;
+    }
+
+    void put(std::uint64_t v) {
+        char digits[20];
+        int k = 0;
+        do {
+            digits[k++] = '0'+v%10;
+            v /= 10;
+        } while (v);
+
+        if (used+k>buffer_size) submit();
+        while (k) buf[used++] = digits[--k];
+    }
+
+    void put(int v) {
+        if (v<0) {
+            put('-');
+            put(static_cast<std::uint64_t>(-static_cast<long long>(v)));
+        }
+        else {
+            put(static_cast<std::uint64_t>(v));
+        }
+    }
+
+    // as `stream_sink::format_entry`
+    void format_entry(const log_entry& entry) {
+        if (emittime && entry.time.ticks) {
+            char tbuf[40];
+            std::size_t n = std::min(format_wall_time(tbuf, sizeof(tbuf), entry.time), sizeof(tbuf)-1);
+            put(tbuf, n);
+            put(' ');
+        }
+        if (emitthread || emitseq) {
+            put('[');
+            if (emitthread) {
+                put('T');
+                put(static_cast<std::uint64_t>(entry.thread));
+            }
+            if (emitthread && emitseq) put(' ');
+            if (emitseq) {
+                put('#');
+                put(entry.sequence);
+            }
+            put("] ");
+        }
+        if (emitfac) {
+            put(entry.name);
+            put(": ");
+        }
+        if (emitloc && entry.location.file!=nullptr) {
+            put(stream_sink::basename(entry.location.file));
+            put(':');
+            put(entry.location.line);
+            put(' ');
+            put(entry.location.func? entry.location.func: "");
+            put(": ");
+        }
+
+        if (emitfields) {
+            for (std::size_t i=0; i<entry.n_fields; ++i) {
+                format_field(entry.fields[i], [this](const char* s, std::size_t k) { put(s, k); });
+                put(' ');
+            }
+        }
+
+        // copy short messages that are to stay buffered beyond this call
+        const char* msg = entry.message? entry.message: "";
+        std::size_t len = std::strlen(msg);
+        if (flush || len>buffer_size/4) put_ref(msg, len);
+        else put(msg, len);
+        put('\n');
+    }
+
+    void write(const log_entry* entries, std::size_t n) {
+        std::lock_guard<std::mutex> guard(mex);
+
+        for (std::size_t i=0; i<n; ++i) {
+            format_entry(entries[i]);
+        }
+        if (flush || external) submit();
+        if (abort) std::abort();
+    }
+};
+
+fd_sink::fd_sink(const std::string& filepath):
+    state_(std::make_shared<state>())
+{
+    state_->fd = ::open(filepath.c_str(), O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0666);
+    if (state_->fd<0) {
+        throw std::system_error(errno, std::generic_category(), "fd_sink: unable to open "+filepath);
+    }
+}
+
+void fd_sink::set(flag f) {
+    std::lock_guard<std::mutex> guard(state_->mex);
+    auto& s = *state_;
+
+    switch (f) {
+    case flag::flush:
+        s.flush = true;
+        s.submit();
+        break;
+    case flag::noflush:
+        s.flush = false;
+        break;
+    case flag::emitloc:
+        s.emitloc = true;
+        break;
+    case flag::noemitloc:
+        s.emitloc = false;
+        break;
+    case flag::emitfac:
+        s.emitfac = true;
+        break;
+    case flag::noemitfac:
+        s.emitfac = false;
+        break;
+    case flag::abort:
+        s.abort = true;
+        break;
+    case flag::noabort:
+        s.abort = false;
+        break;
+    case flag::emittime:
+        s.emittime = true;
+        break;
+    case flag::noemittime:
+        s.emittime = false;
+        break;
+    case flag::emitthread:
+        s.emitthread = true;
+        break;
+    case flag::noemitthread:
+        s.emitthread = false;
+        break;
+    case flag::emitseq:
+        s.emitseq = true;
+        break;
+    case flag::noemitseq:
+        s.emitseq = false;
+        break;
+    case flag::emitfields:
+        s.emitfields = true;
+        break;
+    case flag::noemitfields:
+        s.emitfields = false;
+        break;
+    }
+}
+
+void fd_sink::operator()(const log_entry& entry) {
+    state_->write(&entry, 1);
+}
+
+void fd_sink::operator()(const log_entry* entries, std::size_t n) {
+    state_->write(entries, n);
+}
+
+void fd_sink::flush() {
+    std::lock_guard<std::mutex> guard(state_->mex);
+    state_->submit();
+}
+
+} // namespace log
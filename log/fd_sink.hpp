@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+#include <log/batch_sink.hpp>
+#include <log/facility.hpp>
+#include <log/sinks.hpp>
+
+namespace log {
+
+// `fd_sink` writes records to a file opened with `O_APPEND`, without going
+// through iostreams. Records are formatted as by `stream_sink` (and take the
+// same formatting flags) into a user-space buffer, and submitted with
+// `writev`; message text is referenced in place rather than copied when the
+// records are to be written before the sink call returns.
+//
+// With `flag::flush` (the default), each call to the sink -- one record, or
+// one batch -- is written with a single `writev`. With `flag::noflush`,
+// records accumulate in the buffer and are written when it fills, on
+// `flush()`, and when the last copy of the sink is destroyed.
+//
+// Copies of an `fd_sink` share the descriptor and buffer.
+
+class fd_sink {
+public:
+    static constexpr std::size_t buffer_size = 1<<16;
+
+    template <typename... Flags>
+    explicit fd_sink(const std::string& filepath, Flags... flags): fd_sink(filepath) {
+        flag fs[] = {flags...};
+        for (auto f: fs) {
+            set(f);
+        }
+    }
+
+    // open `filepath` for appending, creating it if necessary; throws
+    // `std::system_error` on failure.
+    explicit fd_sink(const std::string& filepath);
+
+    void set(flag f);
+
+    void operator()(const log_entry& entry);
+    void operator()(const log_entry* entries, std::size_t n);
+
+    // write any buffered records
+    void flush();
+
+private:
+    struct state;
+    std::shared_ptr<state> state_;
+};
+
+} // namespace log
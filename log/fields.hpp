@@ -0,0 +1,242 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace log {
+
+// typed key/value fields attached to a log record
+
+enum class field_type: std::uint8_t {
+    integer,           // `i`
+    unsigned_integer,  // `u`
+    real,              // `d`
+    boolean,           // `b`
+    string,            // `s`, NUL-terminated
+    character          // `c`
+};
+
+struct log_field {
+    const char* key;
+    field_type type;
+    union {
+        std::int64_t i;
+        std::uint64_t u;
+        double d;
+        bool b;
+        const char* s;
+        char c;
+    };
+};
+
+// `kv` makes a field referring to `key` and, for strings, `value`; a
+// `sink_stream` copies both when the field is written to it:
+//
+//     LOG("solver", 1) << log::kv("iter", k) << log::kv("residual", r) << "converged";
+
+namespace impl {
+    inline log_field make_field(const char* key, field_type type) {
+        log_field f;
+        f.key = key;
+        f.type = type;
+        f.u = 0;
+        return f;
+    }
+}
+
+inline log_field kv(const char* key, const char* value) {
+    log_field f = impl::make_field(key, field_type::string);
+    f.s = value;
+    return f;
+}
+
+inline log_field kv(const char* key, const std::string& value) {
+    return kv(key, value.c_str());
+}
+
+inline log_field kv(const char* key, char value) {
+    log_field f = impl::make_field(key, field_type::character);
+    f.c = value;
+    return f;
+}
+
+inline log_field kv(const char* key, bool value) {
+    log_field f = impl::make_field(key, field_type::boolean);
+    f.b = value;
+    return f;
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, log_field>::type
+kv(const char* key, T value) {
+    log_field f = impl::make_field(key, field_type::integer);
+    f.i = value;
+    return f;
+}
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, log_field>::type
+kv(const char* key, T value) {
+    log_field f = impl::make_field(key, field_type::unsigned_integer);
+    f.u = value;
+    return f;
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value, log_field>::type
+kv(const char* key, T value) {
+    log_field f = impl::make_field(key, field_type::real);
+    f.d = value;
+    return f;
+}
+
+// write a field as `key=value` through `put(const char*, std::size_t)`;
+// string and character values are double-quoted if they are empty or contain
+// spaces, quotes, `=`, `\` or control characters. Within quotes, `"` and `\`
+// are escaped with `\`, and control characters as `\n`, `\r`, `\t` or
+// `\xHH`, so that a field never spans lines.
+
+namespace impl {
+    template <typename Put>
+    void format_field_string(const char* s, std::size_t len, Put& put) {
+        bool quote = !len;
+        for (std::size_t i=0; i<len && !quote; ++i) {
+            unsigned char c = s[i];
+            quote = c<=' ' || c=='"' || c=='=' || c=='\\' || c==0x7f;
+        }
+        if (!quote) return put(s, len);
+
+        put("\"", 1);
+        std::size_t from = 0;
+        for (std::size_t i=0; i<len; ++i) {
+            unsigned char c = s[i];
+            char esc[5] = {'\\', 0, 0, 0, 0};
+            std::size_t n = 2;
+
+            if (c=='"' || c=='\\') esc[1] = c;
+            else if (c=='\n') esc[1] = 'n';
+            else if (c=='\r') esc[1] = 'r';
+            else if (c=='\t') esc[1] = 't';
+            else if (c<' ' || c==0x7f) n = std::snprintf(esc, sizeof(esc), "\\x%02x", c);
+            else continue;
+
+            put(s+from, i-from);
+            put(esc, n);
+            from = i+1;
+        }
+        put(s+from, len-from);
+        put("\"", 1);
+    }
+}
+
+template <typename Put>
+void format_field(const log_field& f, Put&& put) {
+    const char* key = f.key? f.key: "";
+    put(key, std::strlen(key));
+    put("=", 1);
+
+    char buf[32];
+    int n = 0;
+    switch (f.type) {
+    case field_type::integer:
+        n = std::snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(f.i));
+        break;
+    case field_type::unsigned_integer:
+        n = std::snprintf(buf, sizeof(buf), "%llu", static_cast<unsigned long long>(f.u));
+        break;
+    case field_type::real:
+        // the shortest of 15 to 17 significant digits that reads back as
+        // the same value
+        for (int digits = 15; digits<=17; ++digits) {
+            n = std::snprintf(buf, sizeof(buf), "%.*g", digits, f.d);
+            if (std::strtod(buf, nullptr)==f.d) break;
+        }
+        break;
+    case field_type::boolean:
+        return f.b? put("true", 4): put("false", 5);
+    case field_type::string: {
+            const char* s = f.s? f.s: "";
+            return impl::format_field_string(s, std::strlen(s), put);
+        }
+    case field_type::character:
+        return impl::format_field_string(&f.c, 1, put);
+    }
+    if (n>0) put(buf, std::min<std::size_t>(n, sizeof(buf)-1));
+}
+
+// `field_store` holds copies of a sequence of fields, together with their
+// keys and string values. Copies of a store are deep; moves keep the text in
+// place.
+
+class field_store {
+public:
+    field_store() = default;
+    field_store(const field_store& other) { assign(other.data(), other.size()); }
+    field_store(field_store&&) = default;
+
+    field_store& operator=(const field_store& other) {
+        if (this!=&other) assign(other.data(), other.size());
+        return *this;
+    }
+    field_store& operator=(field_store&&) = default;
+
+    void clear() {
+        fields_.clear();
+        offsets_.clear();
+        text_.clear();
+    }
+
+    void add(const log_field& f) {
+        std::size_t cap = text_.capacity();
+        std::size_t key = copy(f.key);
+        std::size_t value = f.type==field_type::string? copy(f.s): 0;
+
+        fields_.push_back(f);
+        offsets_.push_back(offsets{key, value});
+        if (text_.capacity()!=cap) {
+            for (std::size_t i=0; i<fields_.size(); ++i) point(i);
+        }
+        else {
+            point(fields_.size()-1);
+        }
+    }
+
+    void assign(const log_field* fields, std::size_t n) {
+        clear();
+        for (std::size_t i=0; i<n; ++i) add(fields[i]);
+    }
+
+    // stored fields; valid until the next modification of the store
+    const log_field* data() const { return fields_.empty()? nullptr: fields_.data(); }
+    std::size_t size() const { return fields_.size(); }
+
+private:
+    struct offsets {
+        std::size_t key, value;
+    };
+
+    std::vector<log_field> fields_;
+    std::vector<offsets> offsets_;
+    std::vector<char> text_;
+
+    std::size_t copy(const char* s) {
+        std::size_t at = text_.size();
+        if (!s) s = "";
+        text_.insert(text_.end(), s, s+std::strlen(s)+1);
+        return at;
+    }
+
+    void point(std::size_t i) {
+        fields_[i].key = text_.data()+offsets_[i].key;
+        if (fields_[i].type==field_type::string) fields_[i].s = text_.data()+offsets_[i].value;
+    }
+};
+
+} // namespace log
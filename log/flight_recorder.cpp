@@ -0,0 +1,367 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <log/clock.hpp>
+#include <log/flight_recorder.hpp>
+
+namespace log {
+
+std::atomic<bool> impl::flight_recording{false};
+
+namespace {
+
+// Rings
+//
+// A ring is written only by the thread that owns it. Slot `pos % capacity`
+// holds the record at position `pos`; its sequence count is `2*pos+1` while
+// it is being written and `2*pos+2` once complete, so that a reader can tell
+// a complete slot from one that is being (or has been) overwritten.
+//
+// Rings are kept in a list that is only ever pushed to, and are never freed:
+// a signal handler may walk the list at any time.
+
+constexpr std::size_t name_capacity = 32;
+
+struct flight_slot {
+    std::atomic<std::uint64_t> seq{0};
+    char name[name_capacity];   // facility name, truncated
+    binary_record record;
+};
+
+struct flight_ring {
+    std::size_t capacity;       // a power of two
+    flight_slot* slots;
+    std::atomic<std::uint64_t> head{0};
+    std::atomic<bool> owned{true};
+    flight_ring* next = nullptr;
+
+    // dump state, used only by the (single) dumping thread
+    std::uint64_t cursor = 0, end = 0;
+    bool pending = false;
+    flight_slot copy;
+
+    explicit flight_ring(std::size_t n): capacity(n), slots(new flight_slot[n]) {}
+};
+
+std::atomic<flight_ring*> rings{nullptr};
+std::atomic<std::size_t> ring_capacity{256};
+
+// releases the thread's ring for reuse when the thread exits
+struct ring_holder {
+    flight_ring* ring = nullptr;
+
+    ~ring_holder() {
+        if (ring) ring->owned.store(false, std::memory_order_release);
+    }
+};
+
+thread_local ring_holder local_ring;
+
+flight_ring* acquire_ring() {
+    std::size_t capacity = ring_capacity.load(std::memory_order_relaxed);
+
+    for (flight_ring* r = rings.load(std::memory_order_acquire); r; r = r->next) {
+        bool owned = false;
+        if (r->capacity==capacity && !r->owned.load(std::memory_order_relaxed) &&
+            r->owned.compare_exchange_strong(owned, true, std::memory_order_acquire)) return r;
+    }
+
+    flight_ring* r = new flight_ring(capacity);
+    r->next = rings.load(std::memory_order_relaxed);
+    while (!rings.compare_exchange_weak(r->next, r, std::memory_order_release)) {}
+    return r;
+}
+
+// Dumping
+
+const char dump_magic[] = "LOGB 1\n";  // as written by `binary_file_writer`
+
+std::atomic<bool> dumping{false};
+char dump_path[4096] = "";
+
+// buffered `write` to a file descriptor
+struct dump_writer {
+    int fd;
+    bool ok = true;
+    std::size_t n = 0;
+    char buf[4096];
+
+    explicit dump_writer(int fd): fd(fd) {}
+
+    void flush() {
+        const char* p = buf;
+        while (ok && n) {
+            ssize_t k = ::write(fd, p, n);
+            if (k<0 && errno==EINTR) continue;
+            if (k<=0) ok = false;
+            else {
+                p += k;
+                n -= k;
+            }
+        }
+        n = 0;
+    }
+
+    void put(const void* data, std::size_t len) {
+        auto p = static_cast<const char*>(data);
+        while (len) {
+            if (n==sizeof(buf)) flush();
+            std::size_t k = std::min(len, sizeof(buf)-n);
+            std::memcpy(buf+n, p, k);
+            n += k;
+            p += k;
+            len -= k;
+        }
+    }
+
+    template <typename T>
+    void put_raw(T x) { put(&x, sizeof(x)); }
+};
+
+// string ids for the dump: strings with static storage (formats and source
+// locations) are remembered by address, facility names by content, in
+// fixed tables; strings that do not fit are written again under a new id.
+
+struct dump_strings {
+    static constexpr unsigned n_static = 1024, n_names = 64;
+
+    dump_writer& out;
+    std::uint32_t next_id = 1;
+    const char* static_keys[n_static];
+    std::uint32_t static_ids[n_static];
+    char names[n_names][name_capacity];
+    std::uint32_t name_ids[n_names];
+    unsigned n_named = 0;
+
+    explicit dump_strings(dump_writer& out): out(out) {
+        for (auto& k: static_keys) k = nullptr;
+    }
+
+    std::uint32_t define(const char* s) {
+        std::uint32_t id = next_id++;
+        std::uint32_t len = static_cast<std::uint32_t>(std::strlen(s));
+        out.put("S", 1);
+        out.put_raw(id);
+        out.put_raw(len);
+        out.put(s, len);
+        return id;
+    }
+
+    std::uint32_t id(const char* s) {
+        if (!s) return 0;
+
+        std::size_t h = (reinterpret_cast<std::uintptr_t>(s)>>3)*0x9e3779b97f4a7c15ull;
+        for (unsigned i=0; i<16; ++i) {
+            unsigned j = (h+i)%n_static;
+            if (static_keys[j]==s) return static_ids[j];
+            if (!static_keys[j]) {
+                static_keys[j] = s;
+                return static_ids[j] = define(s);
+            }
+        }
+        return define(s);
+    }
+
+    std::uint32_t name_id(const char* s) {
+        for (unsigned i=0; i<n_named; ++i) {
+            if (!std::strcmp(names[i], s)) return name_ids[i];
+        }
+        if (n_named==n_names) return define(s);
+
+        std::memcpy(names[n_named], s, name_capacity);
+        return name_ids[n_named++] = define(s);
+    }
+};
+
+// copy the slot at the ring cursor, skipping slots that are incomplete or
+// have been overwritten; false when the ring is exhausted.
+bool next_pending(flight_ring& r) {
+    while (r.cursor<r.end) {
+        std::uint64_t pos = r.cursor++;
+        const flight_slot& s = r.slots[pos&(r.capacity-1)];
+
+        std::uint64_t seq = s.seq.load(std::memory_order_acquire);
+        if (seq!=2*pos+2) continue;
+
+        std::memcpy(r.copy.name, s.name, name_capacity);
+        std::memcpy(static_cast<void*>(&r.copy.record), &s.record, sizeof(binary_record));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.seq.load(std::memory_order_relaxed)!=seq) continue;
+
+        r.copy.name[name_capacity-1] = 0;
+        if (r.copy.record.size>binary_args_capacity) continue;
+        return true;
+    }
+    return false;
+}
+
+void write_record(dump_writer& out, dump_strings& ids, const flight_slot& s) {
+    const binary_record& r = s.record;
+
+    std::uint32_t name = ids.name_id(s.name);
+    std::uint32_t file = ids.id(r.location.file);
+    std::uint32_t func = ids.id(r.location.func);
+    std::uint32_t format = ids.id(r.format);
+
+    out.put("R", 1);
+    out.put_raw(name);
+    out.put_raw(std::int32_t(r.level));
+    out.put_raw(file);
+    out.put_raw(std::int32_t(r.location.line));
+    out.put_raw(func);
+    out.put_raw(format);
+    out.put_raw(r.time.ticks);
+    out.put_raw(r.thread);
+    out.put_raw(r.sequence);
+    out.put_raw(r.size);
+    out.put(r.args, r.size);
+}
+
+// Signal handling
+
+const int fatal_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+constexpr unsigned n_fatal_signals = sizeof(fatal_signals)/sizeof(int);
+
+std::mutex control_mex;
+bool handlers_installed = false;            // guarded by control_mex
+struct sigaction previous[n_fatal_signals];
+
+void on_fatal_signal(int sig, siginfo_t*, void*) {
+    dump_flight_recorder();
+
+    // pass the signal on: with the previous disposition restored, the
+    // raised signal is delivered once this handler returns.
+    for (unsigned i=0; i<n_fatal_signals; ++i) {
+        if (fatal_signals[i]==sig) sigaction(sig, &previous[i], nullptr);
+    }
+    raise(sig);
+}
+
+} // anonymous namespace
+
+void record_flight(const facility_record* data, int level, source_location loc,
+    const char* format, const std::function<void (binary_record&)>& encode)
+{
+    flight_ring* ring = local_ring.ring;
+    if (!ring) ring = local_ring.ring = acquire_ring();
+
+    std::uint64_t pos = ring->head.load(std::memory_order_relaxed);
+    flight_slot& s = ring->slots[pos&(ring->capacity-1)];
+
+    s.seq.store(2*pos+1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const char* name = data->name.load(std::memory_order_relaxed);
+    std::strncpy(s.name, name, name_capacity-1);
+    s.name[name_capacity-1] = 0;
+
+    binary_record& r = s.record;
+    r.facility = nullptr;
+    r.level = level;
+    r.location = loc;
+    r.format = format;
+    r.time = read_clock(clock_source::realtime);
+    r.thread = thread_index();
+    r.sequence = pos;
+    r.size = 0;
+    r.truncated = false;
+    encode(r);
+
+    s.seq.store(2*pos+2, std::memory_order_release);
+    ring->head.store(pos+1, std::memory_order_release);
+}
+
+void start_flight_recorder(const std::string& path, std::size_t capacity, bool handle_signals) {
+    if (path.size()>=sizeof(dump_path)) {
+        throw std::invalid_argument("start_flight_recorder: path too long: "+path);
+    }
+
+    std::size_t n = 1;
+    while (n<capacity) n *= 2;
+
+    std::lock_guard<std::mutex> lock(control_mex);
+    std::memcpy(dump_path, path.c_str(), path.size()+1);
+    ring_capacity.store(n, std::memory_order_relaxed);
+
+    if (handle_signals && !handlers_installed) {
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_sigaction = on_fatal_signal;
+        action.sa_flags = SA_SIGINFO|SA_ONSTACK;
+        sigemptyset(&action.sa_mask);
+
+        for (unsigned i=0; i<n_fatal_signals; ++i) sigaction(fatal_signals[i], &action, &previous[i]);
+        handlers_installed = true;
+    }
+    impl::flight_recording.store(true, std::memory_order_relaxed);
+}
+
+void stop_flight_recorder() {
+    std::lock_guard<std::mutex> lock(control_mex);
+    impl::flight_recording.store(false, std::memory_order_relaxed);
+
+    if (handlers_installed) {
+        for (unsigned i=0; i<n_fatal_signals; ++i) sigaction(fatal_signals[i], &previous[i], nullptr);
+        handlers_installed = false;
+    }
+}
+
+bool dump_flight_recorder() {
+    if (!dump_path[0]) return false;
+
+    int fd;
+    do fd = ::open(dump_path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644); while (fd<0 && errno==EINTR);
+    if (fd<0) return false;
+
+    bool ok = dump_flight_recorder(fd);
+    return ::close(fd)==0 && ok;
+}
+
+bool dump_flight_recorder(int fd) {
+    if (dumping.exchange(true, std::memory_order_acquire)) return false;
+
+    // static: the dump may be made on a small signal stack
+    alignas(dump_writer) static char out_store[sizeof(dump_writer)];
+    alignas(dump_strings) static char ids_store[sizeof(dump_strings)];
+    dump_writer& out = *new (out_store) dump_writer(fd);
+    dump_strings& ids = *new (ids_store) dump_strings(out);
+
+    out.put(dump_magic, sizeof(dump_magic)-1);
+
+    flight_ring* all = rings.load(std::memory_order_acquire);
+    for (flight_ring* r = all; r; r = r->next) {
+        r->end = r->head.load(std::memory_order_acquire);
+        r->cursor = r->end>r->capacity? r->end-r->capacity: 0;
+        r->pending = next_pending(*r);
+    }
+
+    // merge the rings by timestamp
+    for (;;) {
+        flight_ring* first = nullptr;
+        for (flight_ring* r = all; r; r = r->next) {
+            if (r->pending && (!first || r->copy.record.time.ticks<first->copy.record.time.ticks)) first = r;
+        }
+        if (!first) break;
+
+        write_record(out, ids, first->copy);
+        first->pending = next_pending(*first);
+    }
+
+    out.flush();
+    bool ok = out.ok;
+    dumping.store(false, std::memory_order_release);
+    return ok;
+}
+
+} // namespace log
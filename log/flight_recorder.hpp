@@ -0,0 +1,88 @@
+#pragma once
+
+// Flight recorder: per-thread in-memory rings of recent records, dumped when
+// the process dies.
+//
+// `LOG_FLIGHT(fac, n, "x=%d", x)` is a deferred-formatting record (as
+// `LOGB`) that, while the recorder is running, is also copied into a ring
+// belonging to the logging thread *whether or not* the facility level
+// admits it. Recording copies the format pointer and raw arguments into the
+// next ring slot; nothing is formatted, locked or allocated. Each ring holds
+// the last `capacity` records of its thread; the ring of an exited thread is
+// kept, and reused by a later thread.
+//
+// `dump_flight_recorder` writes every ring, merged in timestamp order, in the
+// file format of `binary_file_writer`, to be read back with
+// `decode_binary_log` (or the `log_binary_dump` tool). The dump uses only
+// `open`, `write` and `close`, and so may be made from a signal handler; with
+// `handle_signals`, the recorder installs handlers for SIGSEGV, SIGBUS,
+// SIGFPE, SIGILL and SIGABRT that dump to the configured path and then pass
+// the signal to the handler that was previously installed. A failed `ASSERT`
+// aborts the process, and so is dumped through SIGABRT. Handlers are run on
+// the alternate signal stack of the thread, if it has one.
+//
+// Rings are read without stopping other threads: a slot being overwritten
+// while it is dumped is detected by its sequence count and skipped.
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+#include <log/binary.hpp>
+#include <log/facility.hpp>
+
+namespace log {
+
+// start recording, with rings of `capacity` records (rounded up to a power of
+// two) for threads that do not already have one; dumps go to `path`. Throws
+// `std::invalid_argument` if `path` is too long to be kept.
+void start_flight_recorder(const std::string& path, std::size_t capacity = 256, bool handle_signals = true);
+
+// stop recording, and restore the previous signal handlers; rings are kept
+// and can still be dumped.
+void stop_flight_recorder();
+
+// write all rings to the configured path (truncating it), or to `fd`;
+// async-signal-safe. Returns false if the file could not be written, or if
+// another dump is in progress.
+bool dump_flight_recorder();
+bool dump_flight_recorder(int fd);
+
+namespace impl {
+    extern std::atomic<bool> flight_recording;
+}
+
+inline bool flight_recording() {
+    return impl::flight_recording.load(std::memory_order_relaxed);
+}
+
+// copy a record into the calling thread's ring
+void record_flight(const facility_record* data, int level, source_location loc,
+    const char* format, const std::function<void (binary_record&)>& encode);
+
+// `flight_test` is used by the LOG_FLIGHT macro, as `log_test_proxy` is by
+// LOG: it converts to true if the record is neither recorded nor admitted.
+
+struct flight_proxy {
+    const facility_record* data;
+    bool admitted;
+    bool recorded;
+
+    explicit operator bool() const { return !admitted && !recorded; }
+
+    template <std::size_t N, typename... Args>
+    void log(int level, source_location loc, const char (&format)[N], const Args&... args) const {
+        auto encode = [&](binary_record& r) { encode_args(r, args...); };
+        if (recorded) record_flight(data, level, loc, format, std::ref(encode));
+        if (admitted) submit_binary(data, level, loc, format, std::ref(encode));
+    }
+};
+
+template <bool Literal, typename Fac>
+flight_proxy flight_test(Fac&& fac, int level, facility_site& site, source_location loc) {
+    facility f = site_facility<Literal>(std::forward<Fac>(fac), site);
+    log_test_proxy test(f, level, site, loc);
+    return flight_proxy{f.record(), test.data!=nullptr, flight_recording()};
+}
+
+} // namespace log
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+namespace log {
+
+// `latency_histogram` counts values (sink call durations, in `tsc_clock`
+// ticks) in logarithmic buckets, in the manner of an HDR histogram: values
+// below 16 have a bucket each, and each power-of-two range above that is
+// split into 16 equal buckets, so that a value is known to within 1/16 of
+// itself over the whole 64-bit range.
+//
+// Recording is lock-free: a relaxed atomic increment of one bucket, and a
+// compare-and-swap when a new maximum is seen. `reset` zeroes the buckets
+// while recording continues; values recorded concurrently with a reset may
+// or may not survive it. Quantiles are reported as the upper bound of the
+// bucket containing the given rank, and never exceed the recorded maximum.
+
+struct latency_summary {
+    std::uint64_t count;
+    double p50, p99, p999, max;  // in seconds
+};
+
+class latency_histogram {
+public:
+    static constexpr unsigned sub_bits = 4;
+    static constexpr unsigned sub_buckets = 1u<<sub_bits;
+    static constexpr unsigned n_buckets = (64-sub_bits+1)*sub_buckets;
+
+    latency_histogram() { reset(); }
+
+    latency_histogram(const latency_histogram&) = delete;
+    latency_histogram& operator=(const latency_histogram&) = delete;
+
+    void record(std::uint64_t v) {
+        buckets_[bucket(v)].fetch_add(1, std::memory_order_relaxed);
+
+        std::uint64_t m = max_.load(std::memory_order_relaxed);
+        while (v>m && !max_.compare_exchange_weak(m, v, std::memory_order_relaxed)) {}
+    }
+
+    void reset() {
+        for (auto& b: buckets_) b.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    std::uint64_t count() const {
+        std::uint64_t n = 0;
+        for (auto& b: buckets_) n += b.load(std::memory_order_relaxed);
+        return n;
+    }
+
+    std::uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+
+    // smallest bucket bound at or above the `q`-quantile of the recorded
+    // values; zero if none have been recorded.
+    std::uint64_t quantile(double q) const {
+        std::uint64_t counts[n_buckets];
+        std::uint64_t n = 0;
+        for (unsigned i=0; i<n_buckets; ++i) n += counts[i] = buckets_[i].load(std::memory_order_relaxed);
+        return quantile(q, counts, n);
+    }
+
+    // count, median, 99th and 99.9th percentiles and maximum, converted to
+    // seconds at `ticks_per_second`, from a single pass over the buckets.
+    latency_summary summary(double ticks_per_second) const {
+        std::uint64_t counts[n_buckets];
+        std::uint64_t n = 0;
+        for (unsigned i=0; i<n_buckets; ++i) n += counts[i] = buckets_[i].load(std::memory_order_relaxed);
+
+        auto s = [ticks_per_second](std::uint64_t t) { return t/ticks_per_second; };
+        return latency_summary{n,
+            s(quantile(0.5, counts, n)), s(quantile(0.99, counts, n)), s(quantile(0.999, counts, n)),
+            s(n? max(): 0)};
+    }
+
+    static unsigned bucket(std::uint64_t v) {
+        if (v<sub_buckets) return static_cast<unsigned>(v);
+
+        unsigned e = 63-__builtin_clzll(v);
+        unsigned sub = static_cast<unsigned>(v>>(e-sub_bits))&(sub_buckets-1);
+        return (e-sub_bits+1)*sub_buckets+sub;
+    }
+
+    // largest value counted in bucket `i`
+    static std::uint64_t bucket_bound(unsigned i) {
+        if (i<sub_buckets) return i;
+
+        unsigned shift = i/sub_buckets-1;
+        std::uint64_t lower = std::uint64_t(sub_buckets+i%sub_buckets)<<shift;
+        return lower+((std::uint64_t(1)<<shift)-1);
+    }
+
+private:
+    std::atomic<std::uint64_t> buckets_[n_buckets];
+    std::atomic<std::uint64_t> max_;
+
+    std::uint64_t quantile(double q, const std::uint64_t* counts, std::uint64_t n) const {
+        if (!n) return 0;
+
+        q = std::min(1., std::max(0., q));
+        double r = q*n;
+        std::uint64_t rank = static_cast<std::uint64_t>(r);
+        if (rank<r || !rank) ++rank;
+        std::uint64_t seen = 0;
+        for (unsigned i=0; i<n_buckets; ++i) {
+            seen += counts[i];
+            if (seen>=rank) return std::min(bucket_bound(i), max());
+        }
+        return max();
+    }
+};
+
+} // namespace log
@@ -1,5 +1,12 @@
 #pragma once
 
+#include <climits>
+#include <cstddef>
+
+#include <log/backfill.hpp>
+#include <log/binary.hpp>
+#include <log/flight_recorder.hpp>
+#include <log/rate_limit.hpp>
 #include <log/sinks.hpp>
 #include <log/facility.hpp>
 
@@ -10,13 +17,22 @@ namespace log {
 
 inline int level() { return g_facility_manager.level(); }
 inline void level(int level) { g_facility_manager.level(level); }
+inline int root_level() { return g_facility_manager.root_level(); }
+inline void root_level(int level) { g_facility_manager.root_level(level); }
 inline void default_sink(log_sink_t sink) { g_facility_manager.default_sink(std::move(sink)); }
 inline log_sink_t default_sink() { return g_facility_manager.default_sink(); }
+inline clock_source clock() { return g_facility_manager.clock(); }
+inline void clock(clock_source c) { g_facility_manager.clock(c); }
 
 inline int level(const char* fac) { return facility(fac).level(); }
 inline void level(const char* fac, int level) { facility(fac).level(level); }
+inline void inherit_level(const char* fac) { facility(fac).inherit_level(); }
 inline log_sink_t sink(const char* fac) { return facility(fac).sink(); }
 inline void sink(const char* fac, log_sink_t sink) { facility(fac).sink(std::move(sink)); }
+inline void track_latency(const char* fac, bool on) { facility(fac).track_latency(on); }
+inline latency_summary latency(const char* fac) { return facility(fac).latency(); }
+inline void reset_latency(const char* fac) { facility(fac).reset_latency(); }
+inline void backfill(const char* fac, unsigned depth, int trigger) { facility(fac).backfill(depth, trigger); }
 
 inline int level(const facility &fac) { return fac.level(); }
 inline void level(facility& fac, int level) { fac.level(level); }
@@ -29,18 +45,110 @@ extern facility log;
 extern facility assertion_failure;
 extern facility debug;
 
+// compile-time level threshold: records with a level above
+// `LOG_COMPILE_MIN_LEVEL`, or above the level given for their facility in
+// `LOG_COMPILE_FACILITY_LEVELS`, are compiled out. Facilities are given as
+// a list of `{"name", level},` pairs and matched against the facility
+// argument of the macro as written, e.g.
+//
+//     -DLOG_COMPILE_MIN_LEVEL=2 -D'LOG_COMPILE_FACILITY_LEVELS={"solver", 0},{"::log::debug", 1},'
+
+#ifndef LOG_COMPILE_MIN_LEVEL
+#define LOG_COMPILE_MIN_LEVEL INT_MAX
+#endif
+
+#ifndef LOG_COMPILE_FACILITY_LEVELS
+#define LOG_COMPILE_FACILITY_LEVELS
+#endif
+
+// (the table may differ between translation units, so it and its lookup
+// have internal linkage)
+
+namespace impl {
+namespace {
+    struct compile_level_entry {
+        const char* name;
+        int level;
+    };
+
+    // entry 0 is a placeholder, so that the list may be empty
+    constexpr compile_level_entry compile_levels[] = {{nullptr, 0}, LOG_COMPILE_FACILITY_LEVELS};
+    constexpr std::size_t n_compile_levels = sizeof(compile_levels)/sizeof(compile_levels[0]);
+
+    constexpr bool equal_until(const char* a, const char* b, char end) {
+        return *a? *a==*b && equal_until(a+1, b+1, end): *b==end;
+    }
+
+    // compare a facility name with a stringized macro argument, which may be
+    // a string literal
+    constexpr bool token_names(const char* token, const char* name) {
+        return *token=='"'? equal_until(name, token+1, '"'): equal_until(name, token, 0);
+    }
+
+    // true if a stringized macro argument is a string literal
+    constexpr bool literal_token(const char* token) {
+        return *token=='"';
+    }
+
+    constexpr int compile_level(const char* token, std::size_t i = 1) {
+        return i==n_compile_levels? LOG_COMPILE_MIN_LEVEL:
+            token_names(token, compile_levels[i].name)?
+                (compile_levels[i].level<LOG_COMPILE_MIN_LEVEL? compile_levels[i].level: LOG_COMPILE_MIN_LEVEL):
+                compile_level(token, i+1);
+    }
+} // anonymous namespace
+} // namespace impl
+
+// a record of level `n` is compiled in if `n<=Max`; with a constant level,
+// the test is folded and a compiled-out macro leaves no code or data behind.
+
+template <int Max>
+constexpr bool compiled_in(int n) { return n<=Max; }
+
+#define LOG_COMPILED_OUT(fac, n) (!::log::compiled_in<::log::impl::compile_level(#fac)>(n))
+
 // source location wrapper
 
 #define LOG_LOC ::log::source_location{__FILE__, __LINE__, __PRETTY_FUNCTION__}
 
 // macro wrappers for logging facilities
 
-#define LOG2(fac, n) if (auto log_magic_reserved_temp_ = ::log::log_test_proxy(::log::facility(fac)(n))) ; else log_magic_reserved_temp_.stream << LOG_LOC
+// a distinct `facility_site` for each expansion
+
+#define LOG_CALL_SITE []() -> ::log::facility_site& { static ::log::facility_site s; return s; }()
+
+#define LOG_LITERAL(fac) ::log::impl::literal_token(#fac)
+
+#define LOG_SITE_TEST(fac, n) ::log::site_test<LOG_LITERAL(fac)>(fac, n, LOG_CALL_SITE, LOG_LOC)
+
+#define LOG2(fac, n) if (LOG_COMPILED_OUT(fac, n)) ; else if (auto log_magic_reserved_temp_ = LOG_SITE_TEST(fac, n)) ; else log_magic_reserved_temp_.stream() << LOG_LOC
 #define LOG1(n) LOG2(::log::log, n)
 
 #define LOG_SELECT(_0, _1, _2, ...) _2
 #define LOG(...) LOG_SELECT(__VA_ARGS__, LOG2, LOG1)(__VA_ARGS__)
 
+// rate-limited records: the level test comes first, then the call site's
+// limiter (see `log/rate_limit.hpp`); the record is only constructed if both
+// admit it.
+
+#define LOG_SITE_STATIC(type) []() -> type& { static type s; return s; }()
+
+#define LOG_LIMITED(fac, n, limiter, arg) if (LOG_COMPILED_OUT(fac, n)) ; else if (auto log_magic_reserved_temp_ = LOG_SITE_TEST(fac, n)) ; else if (auto log_magic_reserved_limit_ = LOG_SITE_STATIC(limiter).admit(arg)) ; else log_magic_reserved_temp_.stream() << LOG_LOC << log_magic_reserved_limit_
+
+#define LOG_EVERY_N(fac, n, count) LOG_LIMITED(fac, n, ::log::every_n_limiter, count)
+#define LOG_FIRST_N(fac, n, count) LOG_LIMITED(fac, n, ::log::first_n_limiter, count)
+#define LOG_EVERY_T(fac, n, seconds) LOG_LIMITED(fac, n, ::log::every_t_limiter, seconds)
+#define LOG_RATE(fac, n, per_sec) LOG_LIMITED(fac, n, ::log::rate_limiter, per_sec)
+
+// deferred-formatting records: LOGB(fac, n, format, args...)
+
+#define LOGB(fac, n, ...) if (LOG_COMPILED_OUT(fac, n)) ; else if (auto log_magic_reserved_temp_ = LOG_SITE_TEST(fac, n)) ; else if (!log_magic_reserved_temp_.data) ; else ::log::log_binary(log_magic_reserved_temp_.data, n, LOG_LOC, __VA_ARGS__)
+
+// deferred-formatting records, also kept by the flight recorder regardless of
+// facility level: LOG_FLIGHT(fac, n, format, args...)
+
+#define LOG_FLIGHT(fac, n, ...) if (LOG_COMPILED_OUT(fac, n)) ; else if (auto log_magic_reserved_temp_ = ::log::flight_test<LOG_LITERAL(fac)>(fac, n, LOG_CALL_SITE, LOG_LOC)) ; else log_magic_reserved_temp_.log(n, LOG_LOC, __VA_ARGS__)
+
 #ifndef LOG_NDEBUG
 #define DEBUG(n) LOG2(::log::debug, n)
 #else
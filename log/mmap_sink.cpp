@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <log/mmap_sink.hpp>
+
+namespace log {
+
+constexpr std::size_t mmap_streambuf::chunk_size;
+
+mmap_streambuf::mmap_streambuf(const std::string& filepath) {
+    fd_ = ::open(filepath.c_str(), O_RDWR|O_CREAT|O_CLOEXEC, 0666);
+    if (fd_<0) {
+        throw std::system_error(errno, std::generic_category(), "mmap_streambuf: unable to open "+filepath);
+    }
+
+    struct stat st;
+    if (::fstat(fd_, &st)<0) {
+        std::system_error e(errno, std::generic_category(), "mmap_streambuf: unable to stat "+filepath);
+        ::close(fd_);
+        throw e;
+    }
+
+    // start with an empty put area at the end of the existing contents
+    file_size_ = window_offset_ = st.st_size;
+    setp(nullptr, nullptr);
+}
+
+mmap_streambuf::~mmap_streambuf() {
+    std::size_t len = length();
+    unmap();
+    if (fd_>=0) {
+        if (file_size_!=len) (void)::ftruncate(fd_, len);
+        ::close(fd_);
+    }
+}
+
+std::size_t mmap_streambuf::length() const {
+    return window_? window_offset_+(pptr()-window_): window_offset_;
+}
+
+void mmap_streambuf::unmap() {
+    if (window_) {
+        ::munmap(window_, window_size_);
+        window_ = nullptr;
+    }
+}
+
+// map the next window, starting at the page containing the current length
+bool mmap_streambuf::advance() {
+    std::size_t len = length();
+    unmap();
+    setp(nullptr, nullptr);
+    window_offset_ = len;
+
+    static const std::size_t page = ::sysconf(_SC_PAGESIZE);
+    std::size_t start = len/page*page;
+    std::size_t end = start+chunk_size;
+
+    if (file_size_<end) {
+        if (::fallocate(fd_, 0, file_size_, end-file_size_)<0 && ::ftruncate(fd_, end)<0) return false;
+        file_size_ = end;
+    }
+
+    void* map = ::mmap(nullptr, end-start, PROT_READ|PROT_WRITE, MAP_SHARED, fd_, start);
+    if (map==MAP_FAILED) return false;
+
+    window_ = static_cast<char*>(map);
+    window_size_ = end-start;
+    window_offset_ = start;
+
+    setp(window_, window_+window_size_);
+    pbump(static_cast<int>(len-start));
+    return true;
+}
+
+mmap_streambuf::int_type mmap_streambuf::overflow(int_type c) {
+    if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+    if (pptr()==epptr() && !advance()) return traits_type::eof();
+
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
+}
+
+std::streamsize mmap_streambuf::xsputn(const char* s, std::streamsize n) {
+    std::streamsize done = 0;
+    while (done<n) {
+        if (pptr()==epptr() && !advance()) break;
+
+        std::streamsize k = std::min<std::streamsize>(n-done, epptr()-pptr());
+        std::memcpy(pptr(), s+done, k);
+        pbump(static_cast<int>(k));
+        done += k;
+    }
+    return done;
+}
+
+} // namespace log
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+#include <log/sinks.hpp>
+
+namespace log {
+
+// `mmap_streambuf` appends to a file through a window of the file mapped
+// with `mmap(MAP_SHARED)`. When the window fills, the file is extended by
+// `chunk_size` bytes (with `fallocate` where supported, else `ftruncate`)
+// and the window is moved on; on destruction the file is truncated to the
+// length actually written.
+//
+// Until then, the file may appear longer than its contents, padded with
+// zero bytes.
+
+class mmap_streambuf: public std::streambuf {
+public:
+    static constexpr std::size_t chunk_size = 1<<24;
+
+    // open `filepath` for appending, creating it if necessary; throws
+    // `std::system_error` on failure.
+    explicit mmap_streambuf(const std::string& filepath);
+    ~mmap_streambuf();
+
+    mmap_streambuf(const mmap_streambuf&) = delete;
+    mmap_streambuf& operator=(const mmap_streambuf&) = delete;
+
+    // bytes written to the file, including any existing contents
+    std::size_t length() const;
+
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+
+    // data is already visible to readers of the file: nothing to do.
+    int sync() override { return 0; }
+
+private:
+    int fd_ = -1;
+    char* window_ = nullptr;      // mapped window, or null
+    std::size_t window_size_ = 0;
+    std::size_t window_offset_ = 0; // file offset of window start
+    std::size_t file_size_ = 0;     // allocated file size
+
+    bool advance();
+    void unmap();
+};
+
+class mmap_sink_base {
+protected:
+    std::shared_ptr<mmap_streambuf> buf;
+    std::shared_ptr<std::ostream> stream;
+
+    mmap_sink_base(const std::string& filepath):
+        buf(std::make_shared<mmap_streambuf>(filepath)),
+        stream(std::make_shared<std::ostream>(buf.get())) {}
+};
+
+// `mmap_sink` is a `stream_sink` writing through an `mmap_streambuf`, so
+// that records are formatted straight into the mapped file; as with
+// `file_sink`, it can be subclassed to customize formatting.
+
+class mmap_sink: protected mmap_sink_base, public stream_sink {
+public:
+    template <typename... Flag>
+    explicit mmap_sink(const std::string& filepath, Flag... flags):
+        mmap_sink_base(filepath),
+        stream_sink(*stream, flags...)
+    {}
+};
+
+} // namespace log
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+#include <log/clock.hpp>
+#include <log/facility.hpp>
+#include <log/fields.hpp>
+
+namespace log {
+
+// Per-call-site rate limiters for the `LOG_EVERY_N`, `LOG_FIRST_N`,
+// `LOG_EVERY_T` and `LOG_RATE` macros. Each macro expansion has its own
+// static limiter; its state is updated with relaxed atomics only, and a
+// suppressed call costs a clock read (for the time-based limiters) and an
+// atomic update, with no record constructed.
+//
+// `admit` returns a `limit_result` that, like `log_test_proxy`, converts to
+// true if the record is to be *discarded*. An admitted result carries the
+// number of calls suppressed at the site since the previous admitted record,
+// which is attached to the record as a field `suppressed` when non-zero.
+
+struct limit_result {
+    bool suppress;
+    std::uint64_t suppressed;
+
+    explicit operator bool() const { return suppress; }
+};
+
+inline std::ostream& operator<<(std::ostream& out, const limit_result& r) {
+    if (r.suppressed) out << kv("suppressed", r.suppressed);
+    return out;
+}
+
+// admit the first of every `n` calls
+
+class every_n_limiter {
+public:
+    constexpr every_n_limiter() {}
+
+    limit_result admit(std::uint64_t n) {
+        std::uint64_t k = count_.fetch_add(1, std::memory_order_relaxed);
+        if (n<=1) return limit_result{false, 0};
+        return k%n? limit_result{true, 0}: limit_result{false, k? n-1: 0};
+    }
+
+private:
+    std::atomic<std::uint64_t> count_{0};
+};
+
+// admit the first `n` calls only; once exhausted, a call costs a load
+
+class first_n_limiter {
+public:
+    constexpr first_n_limiter() {}
+
+    limit_result admit(std::uint64_t n) {
+        if (count_.load(std::memory_order_relaxed)>=n) return limit_result{true, 0};
+        return limit_result{count_.fetch_add(1, std::memory_order_relaxed)>=n, 0};
+    }
+
+private:
+    std::atomic<std::uint64_t> count_{0};
+};
+
+// admit at most one call per `seconds`, measured with the coarse monotonic
+// clock (so to within a kernel tick). The time-based limiters can also be
+// given the time of the call, in nanoseconds, explicitly.
+
+class every_t_limiter {
+public:
+    constexpr every_t_limiter() {}
+
+    limit_result admit(double seconds) {
+        return admit(seconds, read_clock(clock_source::monotonic_coarse).ticks);
+    }
+
+    limit_result admit(double seconds, std::uint64_t now) {
+        std::uint64_t interval = seconds>0? static_cast<std::uint64_t>(seconds*1e9): 0;
+
+        std::uint64_t last = last_.load(std::memory_order_relaxed);
+        if ((last && now-last<interval) || !last_.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+            return limit_result{true, 0};
+        }
+        return limit_result{false, suppressed_.exchange(0, std::memory_order_relaxed)};
+    }
+
+private:
+    std::atomic<std::uint64_t> last_{0};  // time of last admitted call; 0 if none
+    std::atomic<std::uint64_t> suppressed_{0};
+};
+
+// token bucket: admit calls at an average of `per_sec` a second, with bursts
+// of up to `per_sec` calls (at least one). The bucket is kept as the time at
+// which it will next be full (the generic cell rate algorithm), so that a
+// call is admitted by a single compare-and-swap.
+
+class rate_limiter {
+public:
+    constexpr rate_limiter() {}
+
+    limit_result admit(double per_sec) {
+        return admit(per_sec, read_clock(clock_source::monotonic_coarse).ticks);
+    }
+
+    limit_result admit(double per_sec, std::uint64_t now) {
+        if (per_sec>0) {
+            std::uint64_t interval = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(1e9/per_sec));
+            std::uint64_t tolerance = std::max<std::uint64_t>(interval, 1000000000);
+
+            std::uint64_t full = full_.load(std::memory_order_relaxed);
+            for (;;) {
+                std::uint64_t next = std::max(full, now)+interval;
+                if (next-now>tolerance) break;
+                if (full_.compare_exchange_weak(full, next, std::memory_order_relaxed)) {
+                    return limit_result{false, suppressed_.exchange(0, std::memory_order_relaxed)};
+                }
+            }
+        }
+        suppressed_.fetch_add(1, std::memory_order_relaxed);
+        return limit_result{true, 0};
+    }
+
+private:
+    std::atomic<std::uint64_t> full_{0};
+    std::atomic<std::uint64_t> suppressed_{0};
+};
+
+} // namespace log
@@ -0,0 +1,328 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <log/clock.hpp>
+#include <log/ring_file_sink.hpp>
+
+namespace log {
+
+// Ring file layout
+//
+// The file is a 64-byte header followed by `capacity` bytes of ring data.
+// `head` counts the bytes ever written to the ring: the frame at logical
+// position `p` lies at offset `p % capacity` in the ring data, and the ring
+// holds the frames between `head-capacity` and `head`.
+//
+// Frames are 8-byte aligned, do not wrap, and record their own logical
+// position, so that a reader can find the oldest intact frame by scanning.
+// When a frame does not fit before the end of the ring, the remainder is
+// filled with a padding frame, or skipped if too small for a frame header.
+
+namespace {
+
+const char ring_magic[8] = {'L', 'O', 'G', 'R', 'I', 'N', 'G', '1'};
+
+struct ring_header {
+    char magic[8];
+    std::uint64_t capacity;
+    std::atomic<std::uint64_t> head;
+    std::uint64_t reserved[5];
+};
+
+static_assert(sizeof(ring_header)==64, "unexpected ring header size");
+
+enum frame_type: std::uint16_t { frame_record = 0, frame_padding = 1 };
+
+struct frame_header {
+    std::uint32_t size;       // total frame bytes, a multiple of 8
+    std::uint32_t check;      // checksum of the frame, excluding this field
+    std::uint64_t pos;        // logical position of the frame
+    std::uint64_t time_ns;    // wall time, or zero
+    std::uint64_t sequence;
+    std::uint32_t thread;
+    std::int32_t level;
+    std::int32_t line;
+    std::uint32_t message_len;
+    std::uint16_t name_len;
+    std::uint16_t file_len;
+    std::uint16_t func_len;
+    std::uint16_t type;
+    // followed by name, file, func and message text
+};
+
+static_assert(sizeof(frame_header)==56, "unexpected frame header size");
+
+constexpr std::size_t min_capacity = 4096;
+
+std::size_t align8(std::size_t n) { return (n+7)&~std::size_t(7); }
+
+std::uint32_t frame_check(const unsigned char* frame, std::size_t size) {
+    std::uint32_t h = 2166136261u;
+    auto mix = [&h](const unsigned char* p, std::size_t n) {
+        for (std::size_t i=0; i<n; ++i) {
+            h ^= p[i];
+            h *= 16777619u;
+        }
+    };
+    mix(frame, 4);
+    mix(frame+8, size-8);
+    return h;
+}
+
+std::system_error os_error(const std::string& what) {
+    return std::system_error(errno, std::generic_category(), what);
+}
+
+} // anonymous namespace
+
+struct ring_file_sink::state {
+    std::mutex mex;
+    int fd = -1;
+    void* map = MAP_FAILED;
+    std::size_t map_size = 0;
+
+    ring_header* header = nullptr;
+    unsigned char* data = nullptr;
+    std::uint64_t capacity = 0;
+
+    state(const std::string& path, std::size_t cap) {
+        capacity = std::max(align8(cap), min_capacity);
+        map_size = sizeof(ring_header)+capacity;
+
+        fd = ::open(path.c_str(), O_RDWR|O_CREAT|O_CLOEXEC, 0666);
+        if (fd<0) throw os_error("ring_file_sink: unable to open "+path);
+
+        struct stat st;
+        if (::fstat(fd, &st)<0) fail("ring_file_sink: unable to stat "+path);
+
+        bool reuse = static_cast<std::size_t>(st.st_size)==map_size;
+        if (!reuse && ::ftruncate(fd, map_size)<0) fail("ring_file_sink: unable to size "+path);
+
+        map = ::mmap(nullptr, map_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+        if (map==MAP_FAILED) fail("ring_file_sink: unable to map "+path);
+
+        header = static_cast<ring_header*>(map);
+        data = static_cast<unsigned char*>(map)+sizeof(ring_header);
+
+        reuse = reuse && !std::memcmp(header->magic, ring_magic, sizeof(ring_magic)) &&
+            header->capacity==capacity && header->head.load()%8==0;
+        if (!reuse) {
+            std::memset(map, 0, sizeof(ring_header));
+            new (&header->head) std::atomic<std::uint64_t>(0);
+            header->capacity = capacity;
+            std::memcpy(header->magic, ring_magic, sizeof(ring_magic));
+        }
+    }
+
+    ~state() {
+        if (map!=MAP_FAILED) ::munmap(map, map_size);
+        if (fd>=0) ::close(fd);
+    }
+
+    [[noreturn]] void fail(const std::string& what) {
+        auto e = os_error(what);
+        ::close(fd);
+        throw e;
+    }
+
+    void write(const log_entry& e) {
+        const char* name = e.name? e.name: "";
+        const char* file = e.location.file? e.location.file: "";
+        const char* func = e.location.func? e.location.func: "";
+        const char* msg = e.message? e.message: "";
+
+        std::size_t name_len = std::min<std::size_t>(std::strlen(name), UINT16_MAX);
+        std::size_t file_len = std::min<std::size_t>(std::strlen(file), UINT16_MAX);
+        std::size_t func_len = std::min<std::size_t>(std::strlen(func), UINT16_MAX);
+        std::size_t msg_len = std::strlen(msg);
+
+        // frames are limited to a quarter of the ring; trim the message to fit.
+        std::size_t max_frame = capacity/4;
+        std::size_t fixed = sizeof(frame_header)+name_len+file_len+func_len;
+        if (fixed+8>max_frame) {
+            name_len = file_len = func_len = 0;
+            fixed = sizeof(frame_header);
+        }
+        msg_len = std::min(msg_len, max_frame-fixed-7);
+        std::size_t size = align8(fixed+msg_len);
+
+        std::lock_guard<std::mutex> guard(mex);
+        std::uint64_t head = header->head.load(std::memory_order_relaxed);
+
+        std::size_t off = head%capacity;
+        if (off+size>capacity) {
+            std::size_t rest = capacity-off;
+            if (rest>=sizeof(frame_header)) {
+                frame_header pad;
+                std::memset(&pad, 0, sizeof(pad));
+                pad.size = static_cast<std::uint32_t>(rest);
+                pad.pos = head;
+                pad.type = frame_padding;
+                put_frame(off, pad);
+            }
+            head += rest;
+            header->head.store(head, std::memory_order_release);
+            off = 0;
+        }
+
+        frame_header h;
+        h.size = static_cast<std::uint32_t>(size);
+        h.check = 0;
+        h.pos = head;
+        h.time_ns = e.time.ticks? wall_time_ns(e.time): 0;
+        h.sequence = e.sequence;
+        h.thread = e.thread;
+        h.level = e.level;
+        h.line = e.location.file? e.location.line: 0;
+        h.message_len = static_cast<std::uint32_t>(msg_len);
+        h.name_len = static_cast<std::uint16_t>(name_len);
+        h.file_len = static_cast<std::uint16_t>(file_len);
+        h.func_len = static_cast<std::uint16_t>(func_len);
+        h.type = frame_record;
+
+        unsigned char* p = data+off+sizeof(frame_header);
+        std::memcpy(p, name, name_len);
+        p += name_len;
+        std::memcpy(p, file, file_len);
+        p += file_len;
+        std::memcpy(p, func, func_len);
+        p += func_len;
+        std::memcpy(p, msg, msg_len);
+        p += msg_len;
+        std::memset(p, 0, data+off+size-p);
+
+        put_frame(off, h);
+        header->head.store(head+size, std::memory_order_release);
+    }
+
+    // write frame header at `off`, then the checksum over the whole frame;
+    // record text is already in place.
+    void put_frame(std::size_t off, frame_header h) {
+        unsigned char* f = data+off;
+        if (h.type==frame_padding) std::memset(f+sizeof(h), 0, h.size-sizeof(h));
+
+        std::memcpy(f, &h, sizeof(h));
+        h.check = frame_check(f, h.size);
+        std::memcpy(f+4, &h.check, 4);
+    }
+};
+
+constexpr std::size_t ring_file_sink::default_capacity;
+
+ring_file_sink::ring_file_sink(const std::string& filepath, std::size_t capacity):
+    state_(std::make_shared<state>(filepath, capacity))
+{}
+
+void ring_file_sink::operator()(const log_entry& entry) {
+    state_->write(entry);
+}
+
+void ring_file_sink::sync() {
+    std::lock_guard<std::mutex> guard(state_->mex);
+    ::msync(state_->map, state_->map_size, MS_SYNC);
+}
+
+std::size_t ring_file_sink::capacity() const {
+    return state_->capacity;
+}
+
+// Recovery
+
+std::size_t recover_ring_file(const std::string& filepath, const log_sink_t& sink) {
+    int fd = ::open(filepath.c_str(), O_RDONLY|O_CLOEXEC);
+    if (fd<0) throw os_error("recover_ring_file: unable to open "+filepath);
+
+    std::vector<unsigned char> buf;
+    unsigned char chunk[1<<16];
+    for (;;) {
+        ssize_t n = ::read(fd, chunk, sizeof(chunk));
+        if (n<0 && errno==EINTR) continue;
+        if (n<0) {
+            auto e = os_error("recover_ring_file: unable to read "+filepath);
+            ::close(fd);
+            throw e;
+        }
+        if (n==0) break;
+        buf.insert(buf.end(), chunk, chunk+n);
+    }
+    ::close(fd);
+
+    std::uint64_t capacity, head;
+    if (buf.size()<sizeof(ring_header) || std::memcmp(buf.data(), ring_magic, sizeof(ring_magic))) {
+        throw std::runtime_error("recover_ring_file: not a ring file: "+filepath);
+    }
+    std::memcpy(&capacity, buf.data()+8, 8);
+    std::memcpy(&head, buf.data()+16, 8);
+    if (capacity%8 || capacity<min_capacity || buf.size()<sizeof(ring_header)+capacity) {
+        throw std::runtime_error("recover_ring_file: bad ring header: "+filepath);
+    }
+    const unsigned char* data = buf.data()+sizeof(ring_header);
+
+    // the frame at logical position `p`, if intact
+    auto frame_at = [&](std::uint64_t p, frame_header& h) {
+        std::size_t off = p%capacity;
+        if (capacity-off<sizeof(frame_header)) return false;
+
+        std::memcpy(&h, data+off, sizeof(h));
+        return h.pos==p && h.size>=sizeof(h) && h.size%8==0 && h.size<=capacity-off &&
+            h.check==frame_check(data+off, h.size) && p+h.size<=head &&
+            (h.type==frame_padding ||
+             sizeof(h)+h.name_len+h.file_len+h.func_len+h.message_len<=h.size);
+    };
+
+    // skip the tail of the ring if too short for a frame
+    auto next_start = [&](std::uint64_t p) {
+        std::size_t rest = capacity-p%capacity;
+        return rest<sizeof(frame_header)? p+rest: p;
+    };
+
+    // scan for intact frames from the oldest position the ring can hold,
+    // following frame sizes, and resynchronizing past any damaged frame.
+    frame_header h;
+    std::uint64_t p = align8(head>capacity? head-capacity: 0);
+    std::size_t count = 0;
+    std::string name, file, func, msg;
+
+    while (p<head) {
+        if (!frame_at(p, h)) {
+            std::uint64_t q = next_start(p);
+            p = q!=p? q: p+8;
+            continue;
+        }
+
+        if (h.type==frame_record) {
+            const char* s = reinterpret_cast<const char*>(data+p%capacity+sizeof(h));
+            name.assign(s, h.name_len);
+            s += h.name_len;
+            file.assign(s, h.file_len);
+            s += h.file_len;
+            func.assign(s, h.func_len);
+            s += h.func_len;
+            msg.assign(s, h.message_len);
+
+            source_location loc = h.file_len?
+                source_location{file.c_str(), h.line, func.c_str()}: no_source_location;
+            timestamp time{clock_source::realtime, h.time_ns};
+
+            if (sink) sink(log_entry{name.c_str(), h.level, loc, msg.c_str(), time, h.thread, h.sequence});
+            ++count;
+        }
+        p = next_start(p+h.size);
+    }
+    return count;
+}
+
+} // namespace log
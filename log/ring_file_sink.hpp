@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <log/facility.hpp>
+
+namespace log {
+
+// `ring_file_sink` keeps the most recent records in a fixed-size file,
+// mapped with `mmap(MAP_SHARED)`, so that they survive the process being
+// killed: records are copied into the mapping as checksummed frames, and
+// the kernel writes the pages back without any system call on the logging
+// path. The file is used as a ring, overwriting the oldest records.
+//
+// An existing ring file of the same capacity is appended to; otherwise the
+// file is (re)initialized. Copies of a `ring_file_sink` share the mapping.
+//
+// `recover_ring_file` reads the records of a ring file, oldest first, and
+// can be used on the file of a crashed process.
+
+class ring_file_sink {
+public:
+    static constexpr std::size_t default_capacity = 1<<24;
+
+    // open or create `filepath` with room for `capacity` bytes of records;
+    // throws `std::system_error` on failure.
+    explicit ring_file_sink(const std::string& filepath, std::size_t capacity = default_capacity);
+
+    void operator()(const log_entry& entry);
+
+    // write the mapping back to the file synchronously (`msync`)
+    void sync();
+
+    std::size_t capacity() const;
+
+private:
+    struct state;
+    std::shared_ptr<state> state_;
+};
+
+// pass the records held in a ring file to `sink`, oldest first; returns the
+// number of records recovered. Timestamps are wall time
+// (`clock_source::realtime`). Throws `std::system_error` if the file cannot
+// be read, and `std::runtime_error` if it is not a ring file.
+
+std::size_t recover_ring_file(const std::string& filepath, const log_sink_t& sink);
+
+} // namespace log
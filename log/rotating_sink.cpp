@@ -0,0 +1,275 @@
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef LOG_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <log/epoch.hpp>
+#include <log/rotating_sink.hpp>
+
+namespace log {
+
+namespace {
+
+struct file_handle {
+    int fd;
+    std::atomic<std::size_t> written;
+    std::atomic<bool> rotation_requested{false};
+
+    file_handle(int fd, std::size_t written): fd(fd), written(written) {}
+    ~file_handle() { ::close(fd); }
+};
+
+int open_append(const std::string& path) {
+    return ::open(path.c_str(), O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0666);
+}
+
+bool exists(const std::string& path) {
+    struct stat st;
+    return ::stat(path.c_str(), &st)==0;
+}
+
+// compress `path` to `path.gz` and remove it; true on success.
+bool gzip_file(const std::string& path) {
+#ifdef LOG_HAVE_ZLIB
+    std::FILE* in = std::fopen(path.c_str(), "rb");
+    if (!in) return false;
+
+    std::string gz_path = path+".gz";
+    gzFile out = gzopen(gz_path.c_str(), "wb");
+    if (!out) {
+        std::fclose(in);
+        return false;
+    }
+
+    bool ok = true;
+    char buf[1<<16];
+    std::size_t n;
+    while (ok && (n = std::fread(buf, 1, sizeof(buf), in))>0) {
+        ok = gzwrite(out, buf, static_cast<unsigned>(n))==static_cast<int>(n);
+    }
+    ok = !std::ferror(in) && ok;
+    std::fclose(in);
+    ok = gzclose(out)==Z_OK && ok;
+
+    if (ok) ::unlink(path.c_str());
+    else ::unlink(gz_path.c_str());
+    return ok;
+#else
+    (void)path;
+    return false;
+#endif
+}
+
+} // anonymous namespace
+
+struct rotating_streambuf::state {
+    std::string path;
+    rotation_policy policy;
+
+    std::atomic<file_handle*> active{nullptr};
+    std::atomic<unsigned> rotations{0};
+    unsigned next_suffix = 1; // background thread only
+
+    std::mutex mex;
+    std::condition_variable wake;
+    bool stop = false;      // guarded by mex
+    bool woken = false;     // guarded by mex: a rotation has been requested
+    std::thread worker;
+
+    state(const std::string& filepath, rotation_policy p): path(filepath), policy(p) {
+        int fd = open_append(path);
+        if (fd<0) {
+            throw std::system_error(errno, std::generic_category(), "rotating_streambuf: unable to open "+path);
+        }
+
+        struct stat st;
+        std::size_t size = ::fstat(fd, &st)==0? st.st_size: 0;
+        active.store(new file_handle(fd, size));
+
+        worker = std::thread([this]() { run(); });
+    }
+
+    ~state() {
+        {
+            std::lock_guard<std::mutex> lock(mex);
+            stop = true;
+        }
+        wake.notify_one();
+        worker.join();
+
+        delete active.load();
+    }
+
+    // called by writers
+    void write(const char* p, std::size_t n) {
+        epoch_guard guard;
+        file_handle* f = active.load(std::memory_order_acquire);
+
+        std::size_t total = 0;
+        while (total<n) {
+            ssize_t w = ::write(f->fd, p+total, n-total);
+            if (w<0) {
+                if (errno==EINTR) continue;
+                break;
+            }
+            total += w;
+        }
+
+        std::size_t bytes = f->written.fetch_add(total, std::memory_order_relaxed)+total;
+        if (policy.max_bytes && bytes>=policy.max_bytes) request(f);
+    }
+
+    // the lock is taken once per file, by the writer that first requests
+    // its rotation
+    void request(file_handle* f) {
+        if (!f->rotation_requested.exchange(true)) {
+            std::lock_guard<std::mutex> lock(mex);
+            woken = true;
+            wake.notify_one();
+        }
+    }
+
+    void run() {
+        using clock = std::chrono::steady_clock;
+        auto due = clock::now()+policy.interval;
+        auto wakeup = [this]() { return stop || woken; };
+
+        std::unique_lock<std::mutex> lock(mex);
+        while (!stop) {
+            if (policy.interval.count()) wake.wait_until(lock, due, wakeup);
+            else wake.wait(lock, wakeup);
+            if (stop) break;
+            woken = false;
+
+            // (a request for a file already rotated away is ignored)
+            bool requested = active.load()->rotation_requested.load();
+            bool expired = policy.interval.count() && clock::now()>=due;
+            if (!requested && !expired) continue;
+
+            lock.unlock();
+            rotate_now();
+            lock.lock();
+            due = clock::now()+policy.interval;
+        }
+    }
+
+    // background thread only: writers are not locked out, but may still
+    // write to the old file until `epoch_synchronize` returns.
+    void rotate_now() {
+        std::string rotated;
+        do {
+            rotated = path+'.'+std::to_string(next_suffix++);
+        } while (exists(rotated) || exists(rotated+".gz"));
+
+        if (::rename(path.c_str(), rotated.c_str())<0) {
+            active.load()->rotation_requested.store(false);
+            return;
+        }
+
+        int fd = open_append(path);
+        if (fd<0) {
+            ::rename(rotated.c_str(), path.c_str());
+            active.load()->rotation_requested.store(false);
+            return;
+        }
+
+        // the switch seen by writers
+        file_handle* old = active.exchange(new file_handle(fd, 0), std::memory_order_acq_rel);
+
+        // wait out writers still using the old descriptor
+        epoch_synchronize();
+        delete old;
+
+        if (policy.compress) gzip_file(rotated);
+        rotations.fetch_add(1, std::memory_order_release);
+    }
+};
+
+constexpr std::size_t rotating_streambuf::buffer_size;
+constexpr std::size_t rotating_streambuf::max_buffer_size;
+
+rotating_streambuf::rotating_streambuf(const std::string& filepath, rotation_policy policy):
+    state_(std::make_shared<state>(filepath, policy)),
+    buf_(buffer_size)
+{
+    setp(buf_.data(), buf_.data()+buf_.size());
+}
+
+rotating_streambuf::~rotating_streambuf() {
+    write_out();
+}
+
+void rotating_streambuf::rotate() {
+    epoch_guard guard;
+    state_->request(state_->active.load(std::memory_order_acquire));
+}
+
+unsigned rotating_streambuf::rotations() const {
+    return state_->rotations.load(std::memory_order_acquire);
+}
+
+bool rotating_streambuf::compression_available() {
+#ifdef LOG_HAVE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+void rotating_streambuf::write_out() {
+    if (pptr()>pbase()) state_->write(pbase(), pptr()-pbase());
+    setp(buf_.data(), buf_.data()+buf_.size());
+    record_end_ = 0;
+}
+
+rotating_streambuf::int_type rotating_streambuf::overflow(int_type c) {
+    std::size_t used = pptr()-pbase();
+
+    // write out complete records, keeping the start of the next
+    if (record_end_) {
+        state_->write(pbase(), record_end_);
+        std::memmove(buf_.data(), buf_.data()+record_end_, used-record_end_);
+        used -= record_end_;
+        record_end_ = 0;
+    }
+
+    // or make room for the record in progress
+    if (used==buf_.size()) {
+        if (buf_.size()<max_buffer_size) {
+            buf_.resize(buf_.size()*2);
+        }
+        else {
+            state_->write(buf_.data(), used);
+            used = 0;
+        }
+    }
+
+    setp(buf_.data(), buf_.data()+buf_.size());
+    pbump(static_cast<int>(used));
+
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+int rotating_streambuf::sync() {
+    write_out();
+    return 0;
+}
+
+} // namespace log
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <log/sinks.hpp>
+
+namespace log {
+
+// when a `rotating_streambuf` switches to a new file
+
+struct rotation_policy {
+    std::size_t max_bytes = 0;                     // file size limit; 0 for none
+    std::chrono::seconds interval{0};              // time limit; 0 for none
+    bool compress = true;                          // gzip rotated files, if built with zlib
+};
+
+// `rotating_streambuf` writes to a file by path; on rotation, the file is
+// renamed with a numeric suffix (`path.1`, `path.2`, ...) and a new file is
+// opened at `path`.
+//
+// Rotation is carried out by a background thread, which opens the new file
+// and then publishes its descriptor with a single atomic exchange; writers
+// only ever load the active descriptor (within an `epoch_guard`), so they
+// neither wait for the rotation nor hold any lock across it. The old file is
+// closed once no writer can still be using it (`epoch_synchronize`), and
+// then compressed on the background thread. Writers that take a file past
+// `max_bytes` only signal the background thread.
+//
+// A rotation can fall between any two writes to the file. So that it falls
+// between records, the buffer is written out only up to the last record end
+// marked with `end_record`; a record that does not fit grows the buffer, up
+// to `max_buffer_size`. (`sync` writes out the whole buffer.)
+
+class rotating_streambuf: public std::streambuf {
+public:
+    static constexpr std::size_t buffer_size = 4096;
+    static constexpr std::size_t max_buffer_size = 1<<20;
+
+    // open `filepath` for appending, creating it if necessary; throws
+    // `std::system_error` on failure.
+    rotating_streambuf(const std::string& filepath, rotation_policy policy);
+    ~rotating_streambuf();
+
+    rotating_streambuf(const rotating_streambuf&) = delete;
+    rotating_streambuf& operator=(const rotating_streambuf&) = delete;
+
+    // request a rotation from the background thread
+    void rotate();
+
+    // mark the end of a record at the current output position
+    void end_record() { record_end_ = pptr()-pbase(); }
+
+    // number of rotations completed, including compression
+    unsigned rotations() const;
+
+    // whether rotated files are compressed
+    static bool compression_available();
+
+protected:
+    int_type overflow(int_type c) override;
+    int sync() override;
+
+private:
+    struct state;
+    std::shared_ptr<state> state_;
+    std::vector<char> buf_;
+    std::size_t record_end_ = 0;   // bytes of complete records in the buffer
+
+    void write_out();
+};
+
+class rotating_file_sink_base {
+protected:
+    std::shared_ptr<rotating_streambuf> buf;
+    std::shared_ptr<std::ostream> stream;
+
+    rotating_file_sink_base(const std::string& filepath, rotation_policy policy):
+        buf(std::make_shared<rotating_streambuf>(filepath, policy)),
+        stream(std::make_shared<std::ostream>(buf.get())) {}
+};
+
+// `rotating_file_sink` is a `stream_sink` writing through a
+// `rotating_streambuf`; as with `file_sink`, it can be subclassed to
+// customize formatting. It marks the end of each record in the buffer: a
+// subclass overriding `format_entry` should call
+// `rotating_file_sink::format_entry` to do so.
+
+class rotating_file_sink: protected rotating_file_sink_base, public stream_sink {
+public:
+    template <typename... Flag>
+    rotating_file_sink(const std::string& filepath, rotation_policy policy, Flag... flags):
+        rotating_file_sink_base(filepath, policy),
+        stream_sink(*stream, flags...)
+    {}
+
+    void rotate() { buf->rotate(); }
+    unsigned rotations() const { return buf->rotations(); }
+
+protected:
+    void format_entry(std::ostream& o, const log_entry& entry) override {
+        stream_sink::format_entry(o, entry);
+        buf->end_record();
+    }
+};
+
+} // namespace log
@@ -1,17 +1,21 @@
 #pragma once
 
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <ostream>
 
+#include <log/batch_sink.hpp>
 #include <log/facility.hpp>
 #include <log/locked_ostream.hpp>
 
 namespace log {
 
 enum class flag {
-    flush, noflush, emitloc, noemitloc, emitfac, noemitfac, abort, noabort
+    flush, noflush, emitloc, noemitloc, emitfac, noemitfac, abort, noabort,
+    emittime, noemittime, emitthread, noemitthread, emitseq, noemitseq,
+    emitfields, noemitfields
 };
 
 class stream_sink {
@@ -56,6 +60,30 @@ public:
         case flag::noabort:
             abort_ = false;
             break;
+        case flag::emittime:
+            emittime_ = true;
+            break;
+        case flag::noemittime:
+            emittime_ = false;
+            break;
+        case flag::emitthread:
+            emitthread_ = true;
+            break;
+        case flag::noemitthread:
+            emitthread_ = false;
+            break;
+        case flag::emitseq:
+            emitseq_ = true;
+            break;
+        case flag::noemitseq:
+            emitseq_ = false;
+            break;
+        case flag::emitfields:
+            emitfields_ = true;
+            break;
+        case flag::noemitfields:
+            emitfields_ = false;
+            break;
         }
     }
 
@@ -67,6 +95,18 @@ public:
         if (abort_) std::abort();
     }
 
+    // write a batch of records under a single acquisition of the stream lock
+    void operator()(const log_entry* entries, std::size_t n) {
+        if (!n) return;
+        auto guard = out_->guard();
+
+        for (std::size_t i=0; i<n; ++i) {
+            format_entry(*out_, entries[i]);
+        }
+        if (flush_) out_->flush();
+        if (abort_) std::abort();
+    }
+
     static const char* basename(const char* path) {
         const char* slash = std::strrchr(path, '/');
         return slash? slash+1: path;
@@ -80,20 +120,48 @@ private:
 protected:
     bool emitloc_ = true;
     bool emitfac_ = false;
+    bool emittime_ = false;
+    bool emitthread_ = false;
+    bool emitseq_ = false;
+    bool emitfields_ = true;
 
     virtual void format_entry(std::ostream& o, const log_entry& entry) {
-        // emit facility name and level, followed by source location,
-        // followed by message.
+        // emit timestamp, thread and sequence number, then facility name and
+        // level, followed by source location, followed by key/value fields
+        // and message.
 
+        if (emittime_ && entry.time.ticks) {
+            format_time(o, entry.time);
+        }
+        if (emitthread_ || emitseq_) {
+            format_origin(o, entry.thread, entry.sequence);
+        }
         if (emitfac_) {
             format_facility(o, entry.name, entry.level);
         }
         if (emitloc_ && entry.location.file!=nullptr) {
             format_location(o, entry.location);
         }
+        if (emitfields_ && entry.n_fields) {
+            format_fields(o, entry.fields, entry.n_fields);
+        }
         format_message(o, entry.message);
     }
 
+    virtual void format_time(std::ostream& o, timestamp time) {
+        char buf[40];
+        format_wall_time(buf, sizeof(buf), time);
+        o << buf << ' ';
+    }
+
+    virtual void format_origin(std::ostream& o, std::uint32_t thread, std::uint64_t sequence) {
+        o << '[';
+        if (emitthread_) o << 'T' << thread;
+        if (emitthread_ && emitseq_) o << ' ';
+        if (emitseq_) o << '#' << sequence;
+        o << "] ";
+    }
+
     virtual void format_facility(std::ostream& o, const char* name, int level) {
         (void)level;
         o << name << ": ";
@@ -103,6 +171,13 @@ protected:
         o << basename(loc.file) << ':' << loc.line << " " << loc.func << ": ";
     }
 
+    virtual void format_fields(std::ostream& o, const log_field* fields, std::size_t n) {
+        for (std::size_t i=0; i<n; ++i) {
+            format_field(fields[i], [&o](const char* s, std::size_t k) { o.write(s, k); });
+            o << ' ';
+        }
+    }
+
     virtual void format_message(std::ostream& o, const char* msg) {
         o << msg << '\n';
     }
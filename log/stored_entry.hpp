@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <log/facility.hpp>
+
+namespace log {
+
+// `stored_entry` keeps a copy of the data referenced by a `log_entry`, for
+// sinks that hold on to records beyond the sink call. Assignment reuses the
+// storage of the previous contents where it can.
+
+class stored_entry {
+public:
+    stored_entry() = default;
+    explicit stored_entry(const log_entry& e) { assign(e); }
+
+    void assign(const log_entry& e) {
+        name_.assign(e.name? e.name: "");
+        level_ = e.level;
+        has_location_ = e.location.file!=nullptr;
+        if (has_location_) {
+            file_.assign(e.location.file);
+            func_.assign(e.location.func? e.location.func: "");
+            line_ = e.location.line;
+        }
+        message_.assign(e.message? e.message: "");
+        time_ = e.time;
+        thread_ = e.thread;
+        sequence_ = e.sequence;
+        fields_.assign(e.fields, e.n_fields);
+    }
+
+    // view of the stored data, valid until the next `assign`
+    log_entry entry() const {
+        source_location loc = has_location_?
+            source_location{file_.c_str(), line_, func_.c_str()}: no_source_location;
+        return log_entry{name_.c_str(), level_, loc, message_.c_str(), time_, thread_, sequence_,
+            fields_.data(), fields_.size()};
+    }
+
+private:
+    std::string name_;
+    int level_ = 0;
+    bool has_location_ = false;
+    std::string file_;
+    int line_ = 0;
+    std::string func_;
+    std::string message_;
+    timestamp time_ = {clock_source::realtime, 0};
+    std::uint32_t thread_ = 0;
+    std::uint64_t sequence_ = 0;
+    field_store fields_;
+};
+
+} // namespace log
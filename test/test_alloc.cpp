@@ -0,0 +1,82 @@
+#include "gtest.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+#include <log/log.hpp>
+
+// Count global allocations made by the current thread.
+
+namespace {
+thread_local long alloc_count = 0;
+}
+
+void* operator new(std::size_t n) {
+    ++alloc_count;
+    if (void* p = std::malloc(n? n: 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+// Discards output, counting records and bytes, without allocating.
+
+struct counting_buf: std::streambuf {
+    std::size_t bytes = 0;
+    int lines = 0;
+
+    int_type overflow(int_type c) override {
+        if (c!=traits_type::eof()) {
+            ++bytes;
+            if (c=='\n') ++lines;
+        }
+        return c;
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        bytes += n;
+        lines += std::count(s, s+n, '\n');
+        return n;
+    }
+};
+
+TEST(alloc, sink_stream) {
+    counting_buf buf;
+    std::ostream out(&buf);
+    log::facility_manager mgr(log::stream_sink(out, log::flag::emitfac, log::flag::emitthread));
+    log::facility test("test", mgr);
+
+    // first record may populate the thread's buffer pool and field store
+    test(0) << log::kv("i", 0) << "warm up " << 1 << ' ' << 2.5;
+    ASSERT_EQ(1, buf.lines);
+
+    long before = alloc_count;
+    for (int i=0; i<100; ++i) {
+        test(0) << LOG_LOC << log::kv("i", i) << "record " << i << ' ' << 2.5*i << " and some more text";
+        test(1) << "disabled " << i;
+    }
+    EXPECT_EQ(before, alloc_count);
+    EXPECT_EQ(101, buf.lines);
+    EXPECT_LT(100u, buf.bytes);
+}
+
+TEST(alloc, long_records) {
+    std::string last;
+    log::facility_manager mgr([&](const log::log_entry& e) { last = e.message; });
+    log::facility test("test", mgr);
+
+    std::string long_message(5000, 'x');
+    test << long_message << 'y';
+    EXPECT_EQ(long_message+'y', last);
+
+    // nested records draw distinct buffers
+    test << "outer " << [&]() { test << "inner"; return 3; }();
+    EXPECT_EQ("outer 3", last);
+}
@@ -1,13 +1,38 @@
 #include "gtest.h"
 
+// records of facility "compiled_out" above level 1 are compiled out
+#define LOG_COMPILE_FACILITY_LEVELS {"compiled_out", 1},
+
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <system_error>
 #include <thread>
 #include <vector>
 
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <log/async_sink.hpp>
+#include <log/dedup_sink.hpp>
+#include <log/fd_sink.hpp>
 #include <log/log.hpp>
+#include <log/mmap_sink.hpp>
+#include <log/ring_file_sink.hpp>
+#include <log/rotating_sink.hpp>
+#include <log/stored_entry.hpp>
 
 #define ASSERT_STRING_HAS(s, match)\
 ASSERT_NE(std::string::npos, std::string(s).find(match))
@@ -146,6 +171,145 @@ TEST(log, stream_sink) {
     ASSERT_STRING_HAS(ss.str(), "xyzzy8");
 }
 
+TEST(log, record_stamp) {
+    std::vector<log::log_entry> entries;
+    log::facility_manager mgr([&](const log::log_entry& e) { entries.push_back(e); });
+    log::facility test("test", mgr);
+
+    auto before = log::read_clock(log::clock_source::realtime);
+    test << "a";
+    test << "b";
+    std::thread([&]() { test << "c"; }).join();
+
+    ASSERT_EQ(3u, entries.size());
+    for (unsigned i=0; i<3; ++i) {
+        EXPECT_EQ(i, entries[i].sequence);
+        EXPECT_EQ(log::clock_source::realtime, entries[i].time.clock);
+        EXPECT_LE(before.ticks, entries[i].time.ticks);
+    }
+    EXPECT_LE(entries[0].time.ticks, entries[1].time.ticks);
+    EXPECT_EQ(log::thread_index(), entries[0].thread);
+    EXPECT_EQ(entries[0].thread, entries[1].thread);
+    EXPECT_NE(entries[0].thread, entries[2].thread);
+
+    mgr.clock(log::clock_source::monotonic_coarse);
+    test << "d";
+    EXPECT_EQ(log::clock_source::monotonic_coarse, entries.back().time.clock);
+    EXPECT_EQ(3u, entries.back().sequence);
+
+    // monotonic timestamps convert to (approximate) wall time
+    auto now = log::read_clock(log::clock_source::realtime);
+    auto wall = log::wall_time_ns(entries.back().time);
+    EXPECT_LT(std::abs(std::int64_t(now.ticks-wall)), std::int64_t(1000000000));
+}
+
+TEST(log, tsc_clock) {
+    std::vector<log::log_entry> entries;
+    log::facility_manager mgr([&](const log::log_entry& e) { entries.push_back(e); });
+    log::facility test("test", mgr);
+
+    mgr.clock(log::clock_source::tsc);
+    EXPECT_EQ(log::clock_source::tsc, mgr.clock());
+    EXPECT_LT(0., log::tsc_clock::ticks_per_second());
+
+    test << "a";
+    test << "b";
+    ASSERT_EQ(2u, entries.size());
+    EXPECT_EQ(log::clock_source::tsc, entries[0].time.clock);
+    EXPECT_LE(entries[0].time.ticks, entries[1].time.ticks);
+
+    auto close_to_now = [](std::uint64_t wall) {
+        auto now = log::read_clock(log::clock_source::realtime).ticks;
+        return std::abs(std::int64_t(now-wall))<std::int64_t(50000000);
+    };
+
+    auto wall = log::wall_time_ns(entries[0].time);
+    EXPECT_TRUE(close_to_now(wall));
+
+    // recalibration does not disturb conversion of earlier ticks
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    log::tsc_clock::recalibrate();
+    EXPECT_TRUE(close_to_now(log::wall_time_ns(log::read_clock(log::clock_source::tsc))));
+    EXPECT_LT(std::abs(std::int64_t(wall-log::wall_time_ns(entries[0].time))), std::int64_t(1000000));
+}
+
+TEST(log, stream_sink_stamp) {
+    using log::flag;
+    std::stringstream ss;
+
+    log::stream_sink sink(ss, flag::noemitloc, flag::emittime, flag::emitthread, flag::emitseq);
+    log::timestamp t{log::clock_source::realtime, 1000000000ull*86400+123456789};
+    sink(log::log_entry{"test", 0, log::no_source_location, "message", t, 3, 42});
+
+    EXPECT_STRING_EQ("1970-01-02T00:00:00.123456Z [T3 #42] message\n", ss.str());
+}
+
+TEST(log, fields) {
+    using log::flag;
+    std::stringstream ss;
+    log::stream_sink text(ss, flag::noemitloc);
+
+    std::vector<log::stored_entry> entries;
+    log::facility_manager mgr([&](const log::log_entry& e) { entries.emplace_back(e); text(e); });
+    log::facility test("test", mgr);
+
+    std::string path = "a \"b\"";
+    test << log::kv("req", 42) << log::kv("n", 7u) << log::kv("ms", 1.5)
+         << log::kv("ok", true) << log::kv("path", path) << "done";
+    path.clear();
+
+    ASSERT_EQ(1u, entries.size());
+    log::stored_entry copy(entries[0]);
+    log::log_entry e = copy.entry();
+    EXPECT_STRING_EQ("done", e.message);
+    ASSERT_EQ(5u, e.n_fields);
+    EXPECT_STRING_EQ("req", e.fields[0].key);
+    EXPECT_EQ(log::field_type::integer, e.fields[0].type);
+    EXPECT_EQ(42, e.fields[0].i);
+    EXPECT_EQ(log::field_type::unsigned_integer, e.fields[1].type);
+    EXPECT_EQ(7u, e.fields[1].u);
+    EXPECT_EQ(log::field_type::real, e.fields[2].type);
+    EXPECT_EQ(1.5, e.fields[2].d);
+    EXPECT_EQ(log::field_type::boolean, e.fields[3].type);
+    EXPECT_TRUE(e.fields[3].b);
+    EXPECT_EQ(log::field_type::string, e.fields[4].type);
+    EXPECT_STRING_EQ("a \"b\"", e.fields[4].s);
+
+    EXPECT_STRING_EQ("req=42 n=7 ms=1.5 ok=true path=\"a \\\"b\\\"\" done\n", ss.str());
+
+    // fields do not carry over to the next record from a pooled buffer
+    test << "plain";
+    EXPECT_EQ(0u, entries.back().entry().n_fields);
+
+    // on other streams, fields are written as text
+    std::stringstream other;
+    other << log::kv("x", -3) << ' ' << log::kv("s", "");
+    EXPECT_STRING_EQ("x=-3 s=\"\"", other.str());
+
+    // control characters are escaped, so that a field stays on one line
+    other.str("");
+    other << log::kv("s", "a\nb\r\tc\x01\\");
+    EXPECT_STRING_EQ("s=\"a\\nb\\r\\tc\\x01\\\\\"", other.str());
+
+    // characters are formatted as one-character strings
+    test << log::kv("c", 'x') << log::kv("q", ' ') << "chars";
+    EXPECT_EQ(log::field_type::character, entries.back().entry().fields[0].type);
+    EXPECT_EQ('x', entries.back().entry().fields[0].c);
+    EXPECT_STRING_HAS(ss.str(), "c=x q=\" \" chars\n");
+
+    // real values are written in full, as briefly as reads back the same
+    for (double d: {0.1, 1.0/3, 2.0/3, 1e300, -5e-324, 123456789.123456789}) {
+        other.str("");
+        other << log::kv("d", d);
+        std::string text = other.str();
+        ASSERT_EQ(0u, text.find("d="));
+        EXPECT_EQ(d, std::strtod(text.c_str()+2, nullptr)) << text;
+    }
+    other.str("");
+    other << log::kv("d", 0.1);
+    EXPECT_STRING_EQ("d=0.1", other.str());
+}
+
 TEST(log, macro) {
     int count = 0;
     std::string message;
@@ -167,6 +331,385 @@ TEST(log, macro) {
     EXPECT_EQ(count, 2);
 }
 
+TEST(log, compile_level) {
+    static_assert(::log::impl::compile_level("\"compiled_out\"")==1, "facility threshold");
+    static_assert(::log::impl::compile_level("\"compiled\"")==INT_MAX, "prefix of a name");
+    static_assert(::log::impl::compile_level("compiled_out")==1, "facility as identifier");
+
+    int count = 0;
+    auto saved_sink = log::default_sink();
+    log::default_sink([&](const log::log_entry&) {});
+    log::level("compiled_out", 5);
+
+    LOG("compiled_out", 2) << ++count;
+    DEBUG(2) << "unaffected";
+    EXPECT_EQ(0, count);
+    LOG("compiled_out", 1) << ++count;
+    EXPECT_EQ(1, count);
+
+    // non-constant levels are tested at run time
+    for (int n=0; n<4; ++n) LOG("compiled_out", n) << ++count;
+    EXPECT_EQ(3, count);
+
+    log::default_sink(saved_sink);
+}
+
+TEST(log, macro_site) {
+    std::string name;
+    auto saved_sink = log::default_sink();
+    log::default_sink([&](const log::log_entry& e) { name = e.name; });
+
+    auto emit = [](int n) { LOG("site_cache", 0) << n; };
+    emit(1);
+    EXPECT_STRING_EQ("site_cache", name);
+
+    // renaming the facility unbinds the call site
+    auto old = log::facility("site_cache");
+    old.name("site_cache_old");
+    name = "";
+    emit(2);
+    EXPECT_STRING_EQ("site_cache", name);
+    EXPECT_STRING_EQ("site_cache_old", old.name());
+
+    // names that are not string literals are looked up each time
+    const char* names[] = {"site_a", "site_b"};
+    for (int i=0; i<4; ++i) {
+        LOG(names[i%2], 0) << i;
+        EXPECT_STRING_EQ(names[i%2], name);
+    }
+
+    // nor are names in arrays of `const char`
+    const char arrays[][8] = {"site_c", "site_d"};
+    for (int i=0; i<4; ++i) {
+        LOG(arrays[i%2], 0) << i;
+        EXPECT_STRING_EQ(arrays[i%2], name);
+        LOGB(arrays[i%2], 0, "%d", i);
+        log::binary_flush();
+        EXPECT_STRING_EQ(arrays[i%2], name);
+    }
+
+    log::default_sink(saved_sink);
+}
+
+TEST(log, rate_limit) {
+    std::vector<std::string> messages;
+    std::vector<std::uint64_t> suppressed;
+    log::facility_manager mgr([&](const log::log_entry& e) {
+        messages.push_back(e.message);
+        std::uint64_t k = 0;
+        for (std::size_t i=0; i<e.n_fields; ++i) {
+            if (!std::strcmp(e.fields[i].key, "suppressed")) k = e.fields[i].u;
+        }
+        suppressed.push_back(k);
+    });
+    log::facility test("test", mgr);
+    test.level(1);
+
+    // suppressed and level-disabled calls build no message
+    int built = 0;
+    auto count = [&built](int i) { ++built; return i; };
+
+    for (int i=0; i<10; ++i) LOG_EVERY_N(test, 1, 4) << count(i);
+    for (int i=0; i<10; ++i) LOG_EVERY_N(test, 2, 4) << count(i);
+    ASSERT_EQ(3u, messages.size());
+    EXPECT_EQ(3, built);
+    EXPECT_STRING_EQ("0", messages[0]);
+    EXPECT_STRING_EQ("4", messages[1]);
+    EXPECT_STRING_EQ("8", messages[2]);
+    EXPECT_EQ(0u, suppressed[0]);
+    EXPECT_EQ(3u, suppressed[1]);
+
+    messages.clear();
+    for (int i=0; i<10; ++i) LOG_FIRST_N(test, 1, 3) << count(i);
+    EXPECT_EQ(3u, messages.size());
+    EXPECT_EQ(6, built);
+
+    messages.clear();
+    suppressed.clear();
+    auto every_hour = [&](int i) { LOG_EVERY_T(test, 1, 3600) << i; };
+    for (int i=0; i<10; ++i) every_hour(i);
+    ASSERT_EQ(1u, messages.size());
+    EXPECT_STRING_EQ("0", messages[0]);
+
+    // a burst of up to `per_sec`, then suppressed until refilled
+    log::rate_limiter rate;
+    const std::uint64_t t0 = 1000000000, ms = 1000000;
+    int admitted = 0;
+    for (int i=0; i<100; ++i) admitted += !rate.admit(20, t0);
+    EXPECT_EQ(20, admitted);
+
+    log::limit_result r = rate.admit(20, t0+49*ms);
+    EXPECT_TRUE(r);
+    r = rate.admit(20, t0+50*ms);
+    EXPECT_FALSE(r);
+    EXPECT_EQ(81u, r.suppressed);
+
+    admitted = 0;
+    for (int i=0; i<10; ++i) admitted += !rate.admit(20, t0+200*ms);
+    EXPECT_EQ(3, admitted);
+
+    // the bucket refills to at most `per_sec`
+    admitted = 0;
+    for (int i=0; i<100; ++i) admitted += !rate.admit(20, t0+60000*ms);
+    EXPECT_EQ(20, admitted);
+
+    // at least one call is admitted, however low the rate
+    log::rate_limiter slow;
+    EXPECT_FALSE(slow.admit(0.001, t0));
+    EXPECT_TRUE(slow.admit(0.001, t0+999*ms));
+
+    // ... and likewise one call per interval with `LOG_EVERY_T`
+    log::every_t_limiter every;
+    EXPECT_FALSE(every.admit(1, t0));
+    EXPECT_TRUE(every.admit(1, t0+999*ms));
+    EXPECT_TRUE(every.admit(1, t0+999*ms));
+    r = every.admit(1, t0+1000*ms);
+    EXPECT_FALSE(r);
+    EXPECT_EQ(2u, r.suppressed);
+
+    // through the macro, suppressed calls build no message, and the count
+    // of suppressed calls is attached to the next admitted record
+    messages.clear();
+    suppressed.clear();
+    built = 0;
+    auto limited = [&](int i) { LOG_RATE(test, 1, 0.001) << count(i); };
+    for (int i=0; i<100; ++i) limited(i);
+    ASSERT_EQ(1u, messages.size());
+    EXPECT_EQ(1, built);
+    EXPECT_STRING_EQ("0", messages[0]);
+}
+
+TEST(log, site_override) {
+    std::vector<std::string> messages;
+    log::facility_manager mgr([&](const log::log_entry& e) { messages.push_back(e.message); });
+    log::facility test("site_override_test", mgr);
+    test.level(0);
+
+    int line_a = 0;
+    auto emit = [&](int n) {
+        LOG(test, n) << "a"; line_a = __LINE__;
+        LOG(test, n) << "b";
+    };
+
+    emit(1);
+    EXPECT_TRUE(messages.empty());
+
+    // registered on first use, whether or not the record was admitted
+    std::vector<const log::facility_site*> sites;
+    log::for_each_site([&](const log::facility_site& s) {
+        if (!std::strcmp(s.facility_name(), "site_override_test")) sites.push_back(&s);
+    });
+    ASSERT_EQ(2u, sites.size());
+    EXPECT_STRING_EQ("test_log.cpp", log::stream_sink::basename(sites[0]->location().file));
+
+    log::site_query q;
+    q.file = "test_log.cpp";
+    q.line = line_a;
+    EXPECT_EQ(1u, log::set_site_override(q, log::site_override::enable));
+
+    emit(1);
+    ASSERT_EQ(1u, messages.size());
+    EXPECT_STRING_EQ("a", messages[0]);
+
+    // overrides take precedence over the facility level in both directions
+    log::site_query all;
+    all.facility = "site_override_*";
+    all.func = "*site_override*";
+    EXPECT_EQ(2u, log::set_site_override(all, log::site_override::disable));
+    emit(0);
+    EXPECT_EQ(1u, messages.size());
+    EXPECT_EQ(log::site_override::disable, sites[0]->enable_override());
+
+    log::set_site_override(all, log::site_override::none);
+    emit(0);
+    EXPECT_EQ(3u, messages.size());
+}
+
+TEST(log, facility_stats) {
+    log::facility_manager mgr([](const log::log_entry&) {});
+    log::facility test("test", mgr);
+    log::facility quiet("quiet", mgr);
+    quiet.sink(log::log_sink_t());
+
+    for (int i=0; i<3; ++i) LOG(test, 1) << "filtered";
+    LOG(test, 0) << "abc";
+    test << "de";
+    LOG(quiet, 0) << "no sink";
+
+    // concurrent threads beyond the inline shards count in allocated blocks
+    unsigned n = 2*log::facility_counters::inline_shards+4;
+    std::atomic<unsigned> counted{0};
+    std::vector<std::thread> threads;
+    std::vector<std::uint32_t> slots(n);
+    for (unsigned i=0; i<n; ++i) {
+        threads.emplace_back([&, i]() {
+            LOG(test, 0) << "x";
+            LOG(test, 1) << "y";
+            slots[i] = log::counter_slot();
+            ++counted;
+            while (counted<n) std::this_thread::yield();
+        });
+    }
+    for (auto& t: threads) t.join();
+    EXPECT_LE(n, *std::max_element(slots.begin(), slots.end())+1);
+
+    // slots of exited threads are reused
+    std::uint32_t slot = UINT32_MAX;
+    std::thread([&slot]() { slot = log::counter_slot(); }).join();
+    EXPECT_GT(log::facility_counters::inline_shards, slot);
+
+    auto stats = mgr.stats();
+    ASSERT_EQ(2u, stats.size());
+
+    EXPECT_EQ("test", stats[0].name);
+    EXPECT_EQ(5u+2*n, stats[0].attempted);
+    EXPECT_EQ(3u+n, stats[0].filtered);
+    EXPECT_EQ(2u+n, stats[0].emitted);
+    EXPECT_EQ(5u+n, stats[0].bytes);
+    EXPECT_LE(0., stats[0].sink_seconds);
+
+    EXPECT_EQ("quiet", stats[1].name);
+    EXPECT_EQ(1u, stats[1].attempted);
+    EXPECT_EQ(0u, stats[1].filtered);
+    EXPECT_EQ(0u, stats[1].emitted);
+}
+
+TEST(log, backfill) {
+    std::vector<std::string> messages;
+    log::facility_manager mgr([&](const log::log_entry& e) { messages.push_back(e.message); });
+    log::facility fac("fac", mgr);
+
+    // level 1 is logged; level 0 triggers a backfill of the last three
+    // records discarded by the level
+    fac.level(1);
+    fac.backfill(3, 0);
+    EXPECT_EQ(3u, fac.backfill_depth());
+
+    for (int i=0; i<5; ++i) LOG(fac, 2) << "detail " << i;
+    LOG(fac, 1) << "info";
+    fac(3) << "detail 5";
+    EXPECT_EQ(std::vector<std::string>{"info"}, messages);
+
+    LOG(fac, 0) << "error";
+    std::vector<std::string> expect = {"info", "detail 3", "detail 4", "detail 5", "error"};
+    EXPECT_EQ(expect, messages);
+
+    // the backfilled records are emitted once
+    LOG(fac, 0) << "again";
+    expect.push_back("again");
+    EXPECT_EQ(expect, messages);
+
+    // records of another thread are kept in that thread's ring
+    messages.clear();
+    std::thread([&]() { LOG(fac, 2) << "other thread"; }).join();
+    LOG(fac, 0) << "error";
+    EXPECT_EQ(std::vector<std::string>{"error"}, messages);
+
+    // ... unless both threads share a backfill scope
+    messages.clear();
+    log::backfill_scope scope;
+    std::thread([&]() {
+        log::backfill_guard guard(scope);
+        LOG(fac, 2) << "in scope";
+    }).join();
+    LOG(fac, 2) << "out of scope";
+    {
+        log::backfill_guard guard(scope);
+        LOG(fac, 0) << "scope error";
+    }
+    expect = {"in scope", "scope error"};
+    EXPECT_EQ(expect, messages);
+
+    // kept records count as filtered; backfilled ones as emitted
+    auto stats = mgr.stats();
+    ASSERT_EQ(1u, stats.size());
+    EXPECT_EQ(9u, stats[0].filtered);
+    EXPECT_EQ(9u, stats[0].emitted);
+
+    // reconfiguring empties the rings
+    messages.clear();
+    fac.backfill(3, 0);
+    LOG(fac, 0) << "error";
+    EXPECT_EQ(std::vector<std::string>{"error"}, messages);
+
+    messages.clear();
+    fac.backfill(0, 0);
+    LOG(fac, 2) << "discarded";
+    LOG(fac, 0) << "error";
+    EXPECT_EQ(std::vector<std::string>{"error"}, messages);
+
+    // records kept for facilities of destroyed managers are never emitted
+    // for new facilities, wherever those are allocated
+    for (int i=0; i<4; ++i) {
+        messages.clear();
+        log::facility_manager other([&](const log::log_entry& e) { messages.push_back(e.message); });
+        log::facility f("fac", other);
+        f.level(1);
+        f.backfill(3, 0);
+        LOG(f, 0) << "error";
+        LOG(f, 2) << "detail";
+        EXPECT_EQ(std::vector<std::string>{"error"}, messages);
+    }
+}
+
+TEST(log, latency_histogram) {
+    using log::latency_histogram;
+
+    // buckets are exact below 16, then within 1/16 of their values
+    for (std::uint64_t v: {0ull, 1ull, 15ull, 16ull, 17ull, 100ull, 1000000ull, ~0ull}) {
+        unsigned i = latency_histogram::bucket(v);
+        ASSERT_LT(i, latency_histogram::n_buckets);
+        EXPECT_LE(v, latency_histogram::bucket_bound(i));
+        EXPECT_LE(latency_histogram::bucket_bound(i)-v, v/16);
+        if (i) EXPECT_LT(latency_histogram::bucket_bound(i-1), v);
+    }
+
+    latency_histogram h;
+    EXPECT_EQ(0u, h.quantile(0.5));
+    for (std::uint64_t v=1; v<=1000; ++v) h.record(v);
+    h.record(1000000);
+
+    EXPECT_EQ(1001u, h.count());
+    EXPECT_EQ(1000000u, h.max());
+    EXPECT_NEAR(501., h.quantile(0.5), 501./16);
+    EXPECT_NEAR(991., h.quantile(0.99), 991./16);
+    EXPECT_EQ(1000000u, h.quantile(1.));
+
+    log::latency_summary s = h.summary(1e6);
+    EXPECT_EQ(1001u, s.count);
+    EXPECT_DOUBLE_EQ(1., s.max);
+    EXPECT_NEAR(501e-6, s.p50, 501e-6/16);
+
+    h.reset();
+    EXPECT_EQ(0u, h.count());
+    EXPECT_EQ(0u, h.max());
+
+    // per-facility tracking of sink calls
+    log::facility_manager mgr([](const log::log_entry&) {});
+    log::facility fac("fac", mgr);
+    EXPECT_FALSE(fac.tracks_latency());
+    LOG(fac, 0) << "untracked";
+    EXPECT_EQ(0u, fac.latency().count);
+
+    fac.track_latency(true);
+    EXPECT_TRUE(fac.tracks_latency());
+    for (int i=0; i<10; ++i) LOG(fac, 0) << "tracked";
+    LOG(fac, 1) << "filtered";
+
+    s = fac.latency();
+    EXPECT_EQ(10u, s.count);
+    EXPECT_LE(s.p50, s.p99);
+    EXPECT_LE(s.p99, s.p999);
+    EXPECT_LE(s.p999, s.max);
+
+    fac.reset_latency();
+    EXPECT_EQ(0u, fac.latency().count);
+
+    fac.track_latency(false);
+    LOG(fac, 0) << "untracked";
+    EXPECT_EQ(0u, fac.latency().count);
+}
+
 TEST(log, global_log) {
     std::string message;
     auto saved_sink = log::sink(log::log);
@@ -206,6 +749,145 @@ TEST(log, rename) {
     EXPECT_STRING_EQ(fac_name, "frood");
 }
 
+TEST(log, level_hierarchy) {
+    log::facility_manager mgr;
+    log::facility cg("solver.linear.cg", mgr);
+    log::facility gmres("solver.linear.gmres", mgr);
+    log::facility nonlinear("solver.nonlinear", mgr);
+    log::facility solverx("solverx", mgr);
+    log::facility io("io", mgr);
+
+    auto levels = [&]() {
+        return std::vector<int>{cg.level(), gmres.level(), nonlinear.level(), solverx.level(), io.level()};
+    };
+
+    // a level set on a prefix applies to all facilities below it
+    log::facility solver("solver", mgr);
+    solver.level(3);
+    EXPECT_EQ((std::vector<int>{3, 3, 3, 0, 0}), levels());
+
+    // ... except where overridden below
+    log::facility linear("solver.linear", mgr);
+    linear.level(1);
+    solver.level(5);
+    EXPECT_EQ((std::vector<int>{1, 1, 5, 0, 0}), levels());
+
+    // new facilities inherit from their nearest ancestor
+    log::facility bicg("solver.linear.bicg", mgr);
+    EXPECT_EQ(1, bicg.level());
+
+    linear.inherit_level();
+    EXPECT_EQ((std::vector<int>{5, 5, 5, 0, 0}), levels());
+    EXPECT_EQ(5, bicg.level());
+
+    // the manager root level is the root of the hierarchy
+    cg.level(0);
+    mgr.root_level(2);
+    EXPECT_EQ((std::vector<int>{0, 5, 5, 2, 2}), levels());
+    EXPECT_EQ(2, log::facility("new", mgr).level());
+
+    // renaming moves a facility in the hierarchy
+    solverx.name("solver.x");
+    EXPECT_EQ(5, solverx.level());
+
+    linear.name("other");
+    EXPECT_EQ(2, linear.level());
+    EXPECT_EQ(5, bicg.level());
+    solver.level(4);
+    EXPECT_EQ((std::vector<int>{0, 4, 4, 4, 2}), levels());
+    EXPECT_EQ(4, bicg.level());
+
+    // levels are used by the macros
+    int count = 0;
+    LOG(gmres, 4) << ++count;
+    LOG(gmres, 5) << ++count;
+    EXPECT_EQ(1, count);
+
+    // the manager level applies to all facilities, discarding their own
+    mgr.level(6);
+    EXPECT_EQ((std::vector<int>{6, 6, 6, 6, 6}), levels());
+    EXPECT_EQ(6, mgr.root_level());
+    cg.level(1);
+    mgr.root_level(7);
+    EXPECT_EQ((std::vector<int>{1, 7, 7, 7, 7}), levels());
+    EXPECT_EQ(7, linear.level());
+}
+
+TEST(log, registry) {
+    log::facility_manager mgr;
+
+    // manager keeps its own copy of facility names
+    char buf[] = "scratch";
+    auto scratch = log::facility(buf, mgr);
+    buf[0] = 'S';
+    EXPECT_STRING_EQ("scratch", scratch.name());
+
+    // concurrent lookup and creation resolve each name to one facility
+    int nname = 200;
+    int nthread = 8;
+    std::vector<std::string> names;
+    for (int i=0; i<nname; ++i) names.push_back("fac"+std::to_string(i));
+
+    std::vector<std::vector<const char*>> found(nthread);
+    std::vector<std::thread> threads;
+    for (int t=0; t<nthread; ++t) {
+        threads.push_back(std::thread([&, t]() {
+            for (int i=0; i<nname; ++i) {
+                auto& name = names[(i+t*7)%nname];
+                found[t].push_back(log::facility(name.c_str(), mgr).name());
+            }
+        }));
+    }
+    for (auto& h: threads) h.join();
+
+    for (int i=0; i<nname; ++i) {
+        const char* expected = log::facility(names[i].c_str(), mgr).name();
+        for (int t=0; t<nthread; ++t) {
+            EXPECT_EQ(expected, found[t][(i-t*7%nname+nname)%nname]);
+        }
+    }
+}
+
+TEST(log, sink_replacement) {
+    log::facility_manager mgr;
+    log::facility fac("swap", mgr);
+
+    std::atomic<int> received(0);
+    std::atomic<int> live(0);
+
+    struct counting_sink {
+        std::atomic<int>* received;
+        std::atomic<int>* live;
+
+        counting_sink(std::atomic<int>& r, std::atomic<int>& l): received(&r), live(&l) { ++*live; }
+        counting_sink(const counting_sink& s): received(s.received), live(s.live) { ++*live; }
+        ~counting_sink() { --*live; }
+
+        void operator()(const log::log_entry&) { ++*received; }
+    };
+
+    fac.sink(counting_sink(received, live));
+
+    int nrecord = 2000;
+    int nthread = 4;
+    std::vector<std::thread> threads;
+    for (int t=0; t<nthread; ++t) {
+        threads.push_back(std::thread([&]() {
+            for (int i=0; i<nrecord; ++i) fac << i;
+        }));
+    }
+    for (int i=0; i<200; ++i) {
+        fac.sink(counting_sink(received, live));
+    }
+    for (auto& h: threads) h.join();
+
+    EXPECT_EQ(nrecord*nthread, received.load());
+
+    // replaced sinks are destroyed once no logger can be using them
+    log::epoch_reclaim();
+    EXPECT_EQ(1, live.load());
+}
+
 struct slow_stream_sink: public log::stream_sink {
     slow_stream_sink(std::ostream &o):
         log::stream_sink(o, log::flag::noemitloc, log::flag::noemitfac) {}
@@ -280,3 +962,847 @@ TEST(log, file_sink) {
 
     EXPECT_STRING_HAS(line, "fancy message");
 }
+
+namespace {
+std::string file_contents(const char* path) {
+    std::ifstream file(path);
+    std::stringstream ss;
+    ss << file.rdbuf();
+    return ss.str();
+}
+}
+
+TEST(log, fd_sink) {
+    using log::flag;
+    temporary_file tmp;
+    ASSERT_TRUE(tmp);
+
+    log::log_entry entries[] = {
+        {"test", 0, log::source_location{"dir/a.cpp", 12, "f()"}, "first",
+            {log::clock_source::realtime, 1}, 3, 7},
+        {"test", 1, log::no_source_location, "second"}
+    };
+
+    // formats as stream_sink does
+    std::stringstream ss;
+    log::stream_sink stream(ss, flag::emitfac, flag::emittime, flag::emitseq);
+    stream(entries, 2);
+
+    {
+        log::fd_sink sink(tmp.path, flag::emitfac, flag::emittime, flag::emitseq);
+        sink(entries[0]);
+        EXPECT_STRING_EQ(ss.str().substr(0, ss.str().find('\n')+1), file_contents(tmp.path));
+        sink(entries+1, 1);
+    }
+    EXPECT_EQ(ss.str(), file_contents(tmp.path));
+
+    // records are appended; unflushed records are written on flush()
+    {
+        log::fd_sink sink(tmp.path, flag::noflush, flag::noemitloc);
+        sink(entries, 2);
+        EXPECT_EQ(ss.str(), file_contents(tmp.path));
+
+        sink.flush();
+        EXPECT_EQ(ss.str()+"first\nsecond\n", file_contents(tmp.path));
+
+        // messages longer than the buffer
+        std::string big(log::fd_sink::buffer_size+10, 'x');
+        log::log_entry e = {"test", 0, log::no_source_location, big.c_str()};
+        sink(e);
+        sink(entries[1]);
+    }
+    std::string big(log::fd_sink::buffer_size+10, 'x');
+    EXPECT_EQ(ss.str()+"first\nsecond\n"+big+"\nsecond\n", file_contents(tmp.path));
+
+    EXPECT_THROW(log::fd_sink("/nonexistent/dir/file"), std::system_error);
+}
+
+TEST(log, mmap_sink) {
+    using log::flag;
+    temporary_file tmp;
+    ASSERT_TRUE(tmp);
+
+    log::log_entry entries[] = {
+        {"test", 0, log::source_location{"dir/a.cpp", 12, "f()"}, "first"},
+        {"test", 1, log::no_source_location, "second"}
+    };
+
+    std::stringstream ss;
+    log::stream_sink stream(ss, flag::emitfac);
+    stream(entries, 2);
+
+    {
+        log::mmap_sink sink(tmp.path, flag::emitfac);
+        sink(entries[0]);
+        sink(entries[1]);
+    }
+    EXPECT_EQ(ss.str(), file_contents(tmp.path));
+
+    // appends to existing contents, across file growth; formatting hooks
+    // can be overridden as for other stream sinks.
+    struct shouting_sink: log::mmap_sink {
+        shouting_sink(const std::string& path): log::mmap_sink(path, flag::noemitloc) {}
+
+    protected:
+        void format_message(std::ostream& o, const char* msg) override {
+            o << msg << "!\n";
+        }
+    };
+
+    std::string big(1<<20, 'x');
+    log::log_entry e = {"test", 0, log::no_source_location, big.c_str()};
+    std::size_t nbig = log::mmap_streambuf::chunk_size/big.size()+2;
+    {
+        shouting_sink sink(tmp.path);
+        for (std::size_t i=0; i<nbig; ++i) sink(e);
+    }
+
+    std::string contents = file_contents(tmp.path);
+    ASSERT_EQ(ss.str().size()+nbig*(big.size()+2), contents.size());
+    EXPECT_EQ(ss.str(), contents.substr(0, ss.str().size()));
+    EXPECT_EQ(big+"!\n", contents.substr(contents.size()-big.size()-2));
+}
+
+TEST(log, rotating_file_sink) {
+    using log::flag;
+    temporary_file tmp;
+    ASSERT_TRUE(tmp);
+    std::string path = tmp.path;
+
+    auto wait_for = [](std::function<bool ()> done) {
+        for (int i=0; i<500 && !done(); ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return done();
+    };
+
+    // rotation by size, with concurrent writers
+    log::rotation_policy policy;
+    policy.max_bytes = 4096;
+    policy.compress = false;
+
+    int nthread = 4;
+    int nrecord = 1000;
+    {
+        log::rotating_file_sink sink(path, policy, flag::noemitloc);
+        log::facility_manager mgr(sink);
+        log::facility test("test", mgr);
+
+        std::vector<std::thread> threads;
+        for (int t=0; t<nthread; ++t) {
+            threads.push_back(std::thread([&, t]() {
+                for (int i=0; i<nrecord; ++i) {
+                    test << t << ' ' << i;
+                    if (i%100==0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }));
+        }
+        for (auto& h: threads) h.join();
+        EXPECT_TRUE(wait_for([&]() { return sink.rotations()>=2; }));
+    }
+
+    // every record is in exactly one file, intact
+    std::vector<std::string> files = {path};
+    for (int k=1; file_contents((path+'.'+std::to_string(k)).c_str()).size(); ++k) {
+        files.push_back(path+'.'+std::to_string(k));
+    }
+    EXPECT_LE(3u, files.size());
+
+    std::vector<std::vector<bool>> seen(nthread, std::vector<bool>(nrecord));
+    int total = 0;
+    for (auto& f: files) {
+        std::stringstream in(file_contents(f.c_str()));
+        int t, i;
+        while (in >> t >> i) {
+            ASSERT_TRUE(t>=0 && t<nthread && i>=0 && i<nrecord);
+            EXPECT_FALSE(seen[t][i]);
+            seen[t][i] = true;
+            ++total;
+        }
+        if (f!=path) std::remove(f.c_str());
+    }
+    EXPECT_EQ(nthread*nrecord, total);
+
+    // records longer than the stream buffer are not split by a rotation
+    std::ofstream(path, std::ios::trunc);
+    std::size_t long_record = 3*log::rotating_streambuf::buffer_size;
+    {
+        log::rotating_file_sink sink(path, policy, flag::noemitloc, flag::noflush);
+        for (int i=0; i<20; ++i) {
+            std::string msg(long_record, 'a'+i);
+            sink(log::log_entry{"test", 0, log::no_source_location, msg.c_str()});
+            if (i%5==4) std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        }
+        EXPECT_TRUE(wait_for([&]() { return sink.rotations()>=2; }));
+    }
+
+    files = {path};
+    for (int k=1; file_contents((path+'.'+std::to_string(k)).c_str()).size(); ++k) {
+        files.push_back(path+'.'+std::to_string(k));
+    }
+    EXPECT_LE(3u, files.size());
+
+    total = 0;
+    for (auto& f: files) {
+        std::stringstream in(file_contents(f.c_str()));
+        std::string line;
+        while (std::getline(in, line)) {
+            ASSERT_EQ(long_record, line.size());
+            EXPECT_EQ(std::string(long_record, line[0]), line);
+            ++total;
+        }
+        if (f!=path) std::remove(f.c_str());
+    }
+    EXPECT_EQ(20, total);
+
+    // requested rotation, with compression
+    policy.max_bytes = 0;
+    policy.compress = true;
+    {
+        log::rotating_file_sink sink(path, policy, flag::noemitloc);
+        sink(log::log_entry{"test", 0, log::no_source_location, "before"});
+        sink.rotate();
+        EXPECT_TRUE(wait_for([&]() { return sink.rotations()==1; }));
+        sink(log::log_entry{"test", 0, log::no_source_location, "after"});
+    }
+    EXPECT_EQ("after\n", file_contents(path.c_str()));
+
+    std::string rotated = path+".1";
+    if (log::rotating_streambuf::compression_available()) {
+        EXPECT_TRUE(file_contents(rotated.c_str()).empty());
+        EXPECT_FALSE(file_contents((rotated+".gz").c_str()).empty());
+        std::remove((rotated+".gz").c_str());
+    }
+    else {
+        EXPECT_NE(std::string::npos, file_contents(rotated.c_str()).find("before"));
+        std::remove(rotated.c_str());
+    }
+}
+
+TEST(log, ring_file_sink) {
+    temporary_file tmp;
+    ASSERT_TRUE(tmp);
+
+    std::vector<std::string> messages;
+    std::vector<std::uint64_t> sequence;
+    auto collect = [&](const log::log_entry& e) {
+        messages.push_back(e.message);
+        sequence.push_back(e.sequence);
+    };
+
+    {
+        log::ring_file_sink ring(tmp.path, 4096);
+        log::facility_manager mgr(ring);
+        log::facility test("test", mgr);
+
+        test << log::source_location{"dir/a.cpp", 12, "f()"} << "first";
+        test << "second";
+    }
+
+    std::vector<log::log_entry> entries;
+    std::vector<std::string> names, files;
+    log::recover_ring_file(tmp.path, [&](const log::log_entry& e) {
+        collect(e);
+        names.push_back(e.name);
+        files.push_back(e.location.file? e.location.file: "");
+        entries.push_back(e);
+    });
+    ASSERT_EQ(2u, messages.size());
+    EXPECT_STRING_EQ("first", messages[0]);
+    EXPECT_STRING_EQ("second", messages[1]);
+    EXPECT_STRING_EQ("test", names[0]);
+    EXPECT_STRING_EQ("dir/a.cpp", files[0]);
+    EXPECT_EQ(12, entries[0].location.line);
+    EXPECT_STRING_EQ("", files[1]);
+    EXPECT_NE(0u, entries[1].time.ticks);
+
+    // reopening appends; the ring keeps the most recent records in order
+    int nrecord = 1000;
+    {
+        log::ring_file_sink ring(tmp.path, 4096);
+        log::facility_manager mgr(ring);
+        log::facility test("test", mgr);
+        for (int i=0; i<nrecord; ++i) test << "record " << i;
+    }
+
+    messages.clear();
+    sequence.clear();
+    auto n = log::recover_ring_file(tmp.path, collect);
+    ASSERT_LT(10u, n);
+    ASSERT_GT(std::size_t(nrecord), n);
+    EXPECT_EQ("record "+std::to_string(nrecord-1), messages.back());
+    for (std::size_t i=1; i<n; ++i) EXPECT_EQ(sequence[i-1]+1, sequence[i]);
+
+    // a damaged frame is skipped
+    {
+        std::fstream f(tmp.path, std::ios::in|std::ios::out|std::ios::binary);
+        f.seekp(64+2048);
+        f.write("garbage!", 8);
+    }
+    messages.clear();
+    sequence.clear();
+    auto m = log::recover_ring_file(tmp.path, collect);
+    EXPECT_GT(n, m);
+    EXPECT_LE(n-2, m);
+    EXPECT_EQ("record "+std::to_string(nrecord-1), messages.back());
+
+    EXPECT_THROW(log::recover_ring_file("/nonexistent/file", collect), std::system_error);
+}
+
+TEST(log, ring_file_sink_killed) {
+    temporary_file tmp;
+    ASSERT_TRUE(tmp);
+
+    // records written by a process that is killed are recovered
+    pid_t pid = fork();
+    ASSERT_LE(0, pid);
+    if (pid==0) {
+        log::ring_file_sink ring(tmp.path, 1<<16);
+        for (int i=0; i<100; ++i) {
+            std::string msg = "record "+std::to_string(i);
+            ring(log::log_entry{"child", 0, log::no_source_location, msg.c_str()});
+        }
+        raise(SIGKILL);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    ASSERT_TRUE(WIFSIGNALED(status));
+
+    std::vector<std::string> messages;
+    log::recover_ring_file(tmp.path, [&](const log::log_entry& e) { messages.push_back(e.message); });
+    ASSERT_EQ(100u, messages.size());
+    EXPECT_EQ("record 0", messages.front());
+    EXPECT_EQ("record 99", messages.back());
+}
+
+TEST(log, async_sink) {
+    std::vector<std::string> messages;
+    std::thread::id sink_thread;
+    log::async_sink async([&](const log::log_entry& e) {
+        messages.push_back(e.message);
+        sink_thread = std::this_thread::get_id();
+    }, 16);
+
+    log::facility_manager mgr(async);
+    log::facility test("test", mgr);
+
+    int nrecord = 500;
+    int nthread = 4;
+    std::vector<std::thread> threads;
+    for (int t=0; t<nthread; ++t) {
+        threads.push_back(std::thread([&, t]() {
+            for (int i=0; i<nrecord; ++i) test << t << ' ' << i;
+        }));
+    }
+    for (auto& h: threads) h.join();
+
+    async.flush();
+    ASSERT_EQ(std::size_t(nrecord*nthread), messages.size());
+    EXPECT_NE(std::this_thread::get_id(), sink_thread);
+
+    // records from each thread arrive in order
+    std::vector<int> next(nthread, 0);
+    for (auto& m: messages) {
+        int t, i;
+        ASSERT_EQ(2, std::sscanf(m.c_str(), "%d %d", &t, &i));
+        EXPECT_EQ(next[t]++, i);
+    }
+
+    // after shutdown, records are passed on directly
+    async.shutdown();
+    test << "late";
+    EXPECT_STRING_EQ("late", messages.back());
+    EXPECT_EQ(std::this_thread::get_id(), sink_thread);
+
+    // one thread at a time
+    messages.clear();
+    threads.clear();
+    for (int t=0; t<nthread; ++t) {
+        threads.push_back(std::thread([&, t]() {
+            for (int i=0; i<100; ++i) test << t << ' ' << i;
+        }));
+    }
+    for (auto& h: threads) h.join();
+    ASSERT_EQ(std::size_t(100*nthread), messages.size());
+
+    std::fill(next.begin(), next.end(), 0);
+    for (auto& m: messages) {
+        int t, i;
+        ASSERT_EQ(2, std::sscanf(m.c_str(), "%d %d", &t, &i));
+        EXPECT_EQ(next[t]++, i);
+    }
+}
+
+// sink that holds up the writer thread until released
+struct gated_sink {
+    struct state {
+        std::atomic<bool> open{false};
+        std::mutex mex;
+        std::vector<std::string> messages;
+        std::vector<std::string> names;
+    };
+    std::shared_ptr<state> s = std::make_shared<state>();
+
+    void operator()(const log::log_entry& e) {
+        while (!s->open) std::this_thread::yield();
+        std::lock_guard<std::mutex> lock(s->mex);
+        s->messages.push_back(e.message);
+        s->names.push_back(e.name);
+    }
+};
+
+TEST(log, async_overflow) {
+    using log::overflow;
+    int nrecord = 100;
+
+    for (auto policy: {overflow::drop, overflow::overwrite, overflow::sync}) {
+        gated_sink gated;
+        log::async_sink async(gated, 4, policy);
+        log::facility_manager mgr(async);
+        log::facility test("test", mgr);
+
+        if (policy==overflow::sync) gated.s->open = true;
+        for (int i=0; i<nrecord; ++i) test << i;
+        gated.s->open = true;
+        async.flush();
+
+        auto& messages = gated.s->messages;
+        std::uint64_t dropped = async.dropped();
+        EXPECT_EQ(dropped, async.dropped("test"));
+        EXPECT_EQ(0u, async.dropped("other"));
+
+        if (policy==overflow::sync) {
+            EXPECT_EQ(0u, dropped);
+            EXPECT_EQ(std::size_t(nrecord), messages.size());
+            continue;
+        }
+
+        EXPECT_LT(0u, dropped);
+
+        // every record is either delivered or counted, followed by a report
+        ASSERT_EQ(nrecord-dropped+1, messages.size());
+        EXPECT_STRING_EQ(std::to_string(dropped)+" records dropped", messages.back());
+        EXPECT_STRING_EQ("test", gated.s->names.back());
+
+        if (policy==overflow::overwrite) {
+            EXPECT_STRING_EQ(std::to_string(nrecord-1), messages[messages.size()-2]);
+        }
+        else {
+            EXPECT_STRING_EQ("0", messages.front());
+        }
+    }
+}
+
+TEST(log, async_drop_table) {
+    // facilities beyond the table's capacity are counted together, under
+    // their own name
+    log::drop_table drops;
+    std::size_t n = log::drop_table::nslot+3;
+    for (std::size_t i=0; i<n; ++i) drops.count(("fac"+std::to_string(i)).c_str());
+
+    std::uint64_t total = 0, other = 0;
+    drops.report([&](const char* name, std::uint64_t k) {
+        if (!std::strcmp(name, log::drop_table::other_name)) other = k;
+        else EXPECT_EQ(1u, k);
+        total += k;
+    });
+    EXPECT_EQ(n, total);
+    EXPECT_EQ(3u, other);
+    EXPECT_EQ(3u, drops.dropped(log::drop_table::other_name));
+    EXPECT_EQ(1u, drops.dropped("fac0"));
+}
+
+TEST(log, async_serial) {
+    // the wrapped sink is never called concurrently, even when records
+    // overflow onto the logging threads
+    std::atomic<bool> busy{false};
+    std::atomic<int> overlaps{0};
+    int count = 0;
+    log::async_sink async([&](const log::log_entry&) {
+        if (busy.exchange(true)) ++overlaps;
+        ++count;
+        busy = false;
+    }, 2, log::overflow::sync);
+    log::facility_manager mgr(async);
+    log::facility test("test", mgr);
+
+    std::vector<std::thread> threads;
+    for (int t=0; t<4; ++t) {
+        threads.emplace_back([&]() { for (int i=0; i<500; ++i) test << i; });
+    }
+    for (auto& h: threads) h.join();
+    async.flush();
+
+    EXPECT_EQ(0, overlaps.load());
+    EXPECT_EQ(2000, count);
+}
+
+TEST(log, async_reentrant) {
+    // a handler logging through its own worker, from the first element the
+    // writer handles, has its elements handled directly rather than waiting
+    // on the (full) queue
+    using worker_type = log::async_worker<int>;
+    for (int k=0; k<50; ++k) {
+        std::vector<int> handled;
+        std::weak_ptr<worker_type> self;
+        worker_type::handlers h;
+        h.deliver = [&](int& x) {
+            handled.push_back(x);
+            if (x==0) {
+                auto w = self.lock();
+                for (int i=1; i<=3; ++i) w->submit("", [i](int& y) { y = i; }, [&handled, i]() { handled.push_back(i); });
+            }
+        };
+        h.name = [](const int&) { return ""; };
+        h.report = [](const char*, std::uint64_t) {};
+
+        auto w = worker_type::start(1, log::overflow::block, std::chrono::seconds(1), std::move(h));
+        self = w;
+        w->submit("", [](int& y) { y = 0; }, []() {});
+        w->flush();
+        w.reset();
+        EXPECT_EQ((std::vector<int>{0, 1, 2, 3}), handled);
+    }
+}
+
+TEST(log, batch_sink) {
+    using log::flag;
+    std::stringstream ss;
+    log::stream_sink stream(ss, flag::noemitloc);
+
+    log::log_entry entries[] = {
+        {"test", 0, log::no_source_location, "a"},
+        {"test", 0, log::no_source_location, "b"}
+    };
+    stream(entries, 2);
+    EXPECT_STRING_EQ("a\nb\n", ss.str());
+
+    // adaptors between single-record and batch sinks
+    std::vector<std::string> messages;
+    log::log_batch_sink_t batch = log::as_batch_sink([&](const log::log_entry& e) { messages.push_back(e.message); });
+    batch(entries, 2);
+    log::as_record_sink(batch)(entries[0]);
+    ASSERT_EQ(3u, messages.size());
+    EXPECT_STRING_EQ("a", messages[2]);
+
+    // async_sink hands queued records to a batch sink together
+    std::atomic<bool> open{false};
+    std::vector<std::size_t> sizes;
+    std::size_t total = 0;
+    log::async_sink async([&](const log::log_entry* es, std::size_t n) {
+        while (!open) std::this_thread::yield();
+        sizes.push_back(n);
+        for (std::size_t i=0; i<n; ++i) EXPECT_EQ(total++, es[i].sequence);
+    }, 1024);
+
+    log::facility_manager mgr(async);
+    log::facility test("test", mgr);
+
+    int nrecord = 300;
+    for (int i=0; i<nrecord; ++i) test << i;
+    open = true;
+    async.flush();
+
+    EXPECT_EQ(std::size_t(nrecord), total);
+    EXPECT_LT(sizes.size(), std::size_t(nrecord));
+    for (auto n: sizes) EXPECT_GE(log::async_worker<log::stored_entry>::max_batch, n);
+}
+
+TEST(log, dedup_sink) {
+    std::mutex mex;
+    std::vector<std::string> messages;
+    std::vector<std::uint64_t> repeated;
+    auto capture = [&](const log::log_entry& e) {
+        std::lock_guard<std::mutex> lock(mex);
+        messages.push_back(e.message);
+        std::uint64_t k = 0;
+        for (std::size_t i=0; i<e.n_fields; ++i) {
+            if (!std::strcmp(e.fields[i].key, "repeated")) k = e.fields[i].u;
+        }
+        repeated.push_back(k);
+    };
+
+    log::dedup_sink dedup(capture, std::chrono::milliseconds(20));
+    log::facility_manager mgr(dedup);
+    log::facility test("test", mgr);
+
+    for (int i=0; i<3; ++i) test << "disk full";
+    test << log::kv("dev", 1) << "disk full";
+    test << log::kv("dev", 1) << "disk full";
+    test << "ok";
+
+    {
+        std::lock_guard<std::mutex> lock(mex);
+        ASSERT_EQ(5u, messages.size());
+        EXPECT_STRING_EQ("disk full", messages[0]);
+        EXPECT_EQ(0u, repeated[0]);
+        EXPECT_STRING_EQ("disk full", messages[1]);
+        EXPECT_EQ(2u, repeated[1]);
+        EXPECT_EQ(0u, repeated[2]);
+        EXPECT_EQ(1u, repeated[3]);
+        EXPECT_STRING_EQ("ok", messages[4]);
+    }
+    EXPECT_EQ(3u, dedup.suppressed());
+
+    // a run still in progress is reported when the window expires
+    test << "ok";
+    test << "ok";
+    for (int i=0; i<200; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        std::lock_guard<std::mutex> lock(mex);
+        if (messages.size()>5) break;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mex);
+        ASSERT_EQ(6u, messages.size());
+        EXPECT_STRING_EQ("ok", messages[5]);
+        EXPECT_EQ(2u, repeated[5]);
+    }
+
+    // the wrapped sink may log through the dedup sink itself; such records
+    // are passed on after the record being handled
+    std::vector<std::string> echoed;
+    std::function<void (const log::log_entry&)> self;
+    log::dedup_sink echo([&](const log::log_entry& e) {
+        echoed.push_back(e.message);
+        if (!std::strcmp(e.message, "ping")) self(log::log_entry{"test", 0, log::no_source_location, "pong"});
+    });
+    self = echo;
+    echo(log::log_entry{"test", 0, log::no_source_location, "ping"});
+    ASSERT_EQ(2u, echoed.size());
+    EXPECT_EQ("pong", echoed[1]);
+}
+
+TEST(log, binary_log) {
+    std::string message;
+    int level = -1;
+    auto saved_sink = log::default_sink();
+    log::default_sink([&](const log::log_entry& e) { message = e.message; level = e.level; });
+    log::level(1);
+
+    LOGB("binary", 1, "x=%d y=%.2f s=%s c=%c %%", -3, 1.5, std::string("str"), 'q');
+    log::binary_flush();
+    EXPECT_STRING_EQ("x=-3 y=1.50 s=str c=q %", message);
+    EXPECT_EQ(1, level);
+
+    // arguments of disabled records are not evaluated
+    int count = 0;
+    LOGB("binary", 2, "%d", ++count);
+    log::binary_flush();
+    EXPECT_EQ(0, count);
+    EXPECT_STRING_EQ("x=-3 y=1.50 s=str c=q %", message);
+
+    // length modifiers are replaced to suit the stored argument
+    LOGB("binary", 0, "%lu %hhd %5.3s|%-4d|%*d", 12u, 300, "abcdef", 7, 3, 9);
+    log::binary_flush();
+    EXPECT_STRING_EQ("12 300   abc|7   |  9", message);
+
+    log::default_sink(saved_sink);
+
+    // records for facilities of a manager are handled before it is
+    // destroyed, however slow the handler
+    log::binary_handler([](const log::binary_record& r) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        log::binary_to_text(r);
+    });
+    std::vector<std::string> messages;
+    for (int i=0; i<20; ++i) {
+        log::facility_manager mgr([&](const log::log_entry& e) { messages.push_back(e.message); });
+        log::facility local("local", mgr);
+        LOGB(local, 0, "local %d of %s", i, "twenty");
+    }
+    log::binary_flush();
+    log::binary_handler(log::binary_to_text);
+    ASSERT_EQ(20u, messages.size());
+    EXPECT_EQ("local 19 of twenty", messages.back());
+}
+
+TEST(log, binary_format) {
+    log::binary_record r;
+    r.format = "%s and %d";
+    log::encode_args(r, "abc", 12345);
+
+    char buf[8];
+    EXPECT_EQ(13u, r.format_to(buf, sizeof(buf)));
+    EXPECT_STRING_EQ("abc and", buf);
+    EXPECT_EQ("abc and 12345", r.message());
+
+    // arguments that do not fit are dropped
+    log::binary_record t;
+    t.format = "%s %d";
+    log::encode_args(t, std::string(300, 'a'), 1);
+    EXPECT_TRUE(t.truncated);
+    EXPECT_EQ(std::string(log::binary_args_capacity-3, 'a')+" ", t.message());
+
+    // `*` widths and precisions are clamped
+    log::binary_record u;
+    u.format = "%-+ #0-+*.*d|";
+    log::encode_args(u, INT_MIN, INT_MIN, 42);
+    EXPECT_EQ("+42"+std::string(9996, ' ')+"|", u.message());
+
+    u = log::binary_record{};
+    u.format = "%*.*d|";
+    log::encode_args(u, INT_MAX, INT_MAX, 42);
+    EXPECT_EQ(10000u, u.message().size());
+}
+
+TEST(log, binary_decode_truncated) {
+    temporary_file tmp;
+    ASSERT_TRUE(tmp);
+
+    log::binary_handler(log::binary_file_writer(tmp.path));
+    log::facility fac("binary_truncated");
+    fac.level(0);
+    LOGB(fac, 0, "%d %s %d", 7, "abcdef", 8);
+    log::binary_flush();
+    log::binary_handler(log::binary_to_text);
+
+    std::string data;
+    {
+        std::ifstream in(tmp.path, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    // the record is last in the file: size (u32), then the arguments
+    // tag sint:8 | tag len:2 "abcdef" | tag sint:8, 27 bytes in all.
+    const std::uint32_t full = 27;
+    ASSERT_GT(data.size(), full+4);
+    std::size_t at = data.size()-full-4;
+    std::uint32_t size;
+    std::memcpy(&size, &data[at], 4);
+    ASSERT_EQ(full, size);
+
+    // cut the arguments short, keeping the size field consistent with the
+    // bytes that remain, or claiming a longer string than is stored
+    auto decode = [&](std::uint32_t keep, int string_len = -1) {
+        std::string cut = data.substr(0, at+4+keep);
+        std::memcpy(&cut[at], &keep, 4);
+        if (string_len>=0) {
+            std::uint16_t l = static_cast<std::uint16_t>(string_len);
+            std::memcpy(&cut[at+4+9+1], &l, 2);
+        }
+        std::istringstream in(cut);
+        std::vector<std::string> messages;
+        auto n = log::decode_binary_log(in, [&](const log::log_entry& e) { messages.push_back(e.message); });
+        EXPECT_EQ(1u, n);
+        return messages.empty()? std::string(): messages[0];
+    };
+
+    EXPECT_EQ("7 abcdef 8", decode(full));
+    EXPECT_EQ("7 abcdef ", decode(full-1));
+    EXPECT_EQ("7  ", decode(15));
+    EXPECT_EQ("7  ", decode(full, 65535));
+    EXPECT_EQ("  ", decode(5));
+}
+
+TEST(log, binary_file) {
+    temporary_file tmp;
+    ASSERT_TRUE(tmp);
+
+    log::level(1);
+    log::binary_handler(log::binary_file_writer(tmp.path));
+    for (int i=0; i<3; ++i) {
+        LOGB("binary_file", 0, "record %d of %s", i, "three");
+    }
+    log::binary_flush();
+    log::binary_handler(log::binary_to_text);
+
+    std::vector<std::string> messages;
+    std::ifstream in(tmp.path, std::ios::binary);
+    auto n = log::decode_binary_log(in, [&](const log::log_entry& e) {
+        EXPECT_STRING_EQ("binary_file", e.name);
+        EXPECT_STRING_HAS(e.location.file, "test_log.cpp");
+        EXPECT_NE(0u, e.time.ticks);
+        messages.push_back(e.message);
+    });
+
+    ASSERT_EQ(3u, n);
+    EXPECT_EQ("record 0 of three", messages[0]);
+    EXPECT_EQ("record 2 of three", messages[2]);
+}
+
+namespace {
+std::vector<log::stored_entry> decode_flight_dump(const char* path) {
+    std::vector<log::stored_entry> entries;
+    std::ifstream in(path, std::ios::binary);
+    log::decode_binary_log(in, [&](const log::log_entry& e) { entries.emplace_back(e); });
+    return entries;
+}
+}
+
+TEST(log, flight_recorder) {
+    temporary_file tmp;
+    ASSERT_TRUE(tmp);
+
+    std::vector<std::string> emitted;
+    log::facility_manager mgr([&](const log::log_entry& e) { emitted.push_back(e.message); });
+    log::facility flight("flight", mgr);
+
+    LOG_FLIGHT(flight, 1, "not recording");
+    log::start_flight_recorder(tmp.path, 8, false);
+
+    // records are kept whether or not the facility admits them; the ring
+    // keeps the last 8 of the thread
+    for (int i=0; i<12; ++i) LOG_FLIGHT(flight, 1, "quiet %d", i);
+    std::thread([&]() { LOG_FLIGHT(flight, 2, "from %s", "thread"); }).join();
+    LOG_FLIGHT(flight, 0, "loud %d", 0);
+    log::binary_flush();
+
+    ASSERT_EQ(1u, emitted.size());
+    EXPECT_EQ("loud 0", emitted[0]);
+
+    ASSERT_TRUE(log::dump_flight_recorder());
+    std::vector<log::log_entry> entries;
+    auto stored = decode_flight_dump(tmp.path);
+    for (auto& s: stored) entries.push_back(s.entry());
+
+    ASSERT_EQ(9u, entries.size());
+    EXPECT_STRING_EQ("quiet 5", entries[0].message);
+    EXPECT_STRING_EQ("quiet 11", entries[6].message);
+    EXPECT_STRING_EQ("from thread", entries[7].message);
+    EXPECT_STRING_EQ("loud 0", entries[8].message);
+    for (std::size_t i=0; i<entries.size(); ++i) {
+        EXPECT_STRING_EQ("flight", entries[i].name);
+        if (i) EXPECT_LE(entries[i-1].time.ticks, entries[i].time.ticks);
+    }
+    EXPECT_EQ(2, entries[7].level);
+    EXPECT_NE(entries[6].thread, entries[7].thread);
+
+    log::stop_flight_recorder();
+    LOG_FLIGHT(flight, 1, "stopped");
+    ASSERT_TRUE(log::dump_flight_recorder());
+    EXPECT_EQ(9u, decode_flight_dump(tmp.path).size());
+}
+
+TEST(log, flight_recorder_fatal) {
+    for (int sig: {SIGABRT, SIGSEGV}) {
+        temporary_file tmp;
+        ASSERT_TRUE(tmp);
+
+        // the rings are dumped by a failed ASSERT or a fatal signal
+        pid_t pid = fork();
+        ASSERT_LE(0, pid);
+        if (pid==0) {
+            log::start_flight_recorder(tmp.path);
+            for (int i=0; i<3; ++i) LOG_FLIGHT("flight_fatal", 5, "before %d", i);
+            if (sig==SIGABRT) ASSERT(false) << "flight recorder test";
+            else raise(SIGSEGV);
+            _exit(0);
+        }
+
+        int status;
+        waitpid(pid, &status, 0);
+        ASSERT_TRUE(WIFSIGNALED(status));
+        EXPECT_EQ(sig, WTERMSIG(status));
+
+        // (the child also inherits the rings of earlier tests)
+        std::vector<std::string> messages;
+        for (auto& s: decode_flight_dump(tmp.path)) {
+            log::log_entry e = s.entry();
+            if (!std::strcmp(e.name, "flight_fatal")) messages.push_back(e.message);
+        }
+        ASSERT_EQ(3u, messages.size());
+        EXPECT_EQ("before 2", messages[2]);
+    }
+}
@@ -0,0 +1,30 @@
+// Print the records held in a binary log file, as written by a
+// `binary_file_writer` or dumped by the flight recorder.
+//
+// usage: log_binary_dump FILE
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include <log/binary.hpp>
+#include <log/sinks.hpp>
+
+int main(int argc, char** argv) {
+    using log::flag;
+
+    if (argc!=2) {
+        std::fprintf(stderr, "usage: %s FILE\n", argv[0]);
+        return 2;
+    }
+
+    std::ifstream in(argv[1], std::ios::binary);
+    if (!in) {
+        std::fprintf(stderr, "%s: unable to open %s\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    log::stream_sink out(std::cout, flag::noflush, flag::emittime, flag::emitthread, flag::emitseq, flag::emitfac);
+    log::decode_binary_log(in, out);
+    std::cout.flush();
+}
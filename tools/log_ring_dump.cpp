@@ -0,0 +1,29 @@
+// Print the records held in a `ring_file_sink` file, oldest first.
+//
+// usage: log_ring_dump FILE
+
+#include <cstdio>
+#include <exception>
+#include <iostream>
+
+#include <log/ring_file_sink.hpp>
+#include <log/sinks.hpp>
+
+int main(int argc, char** argv) {
+    using log::flag;
+
+    if (argc!=2) {
+        std::fprintf(stderr, "usage: %s FILE\n", argv[0]);
+        return 2;
+    }
+
+    try {
+        log::stream_sink out(std::cout, flag::noflush, flag::emittime, flag::emitthread, flag::emitseq, flag::emitfac);
+        log::recover_ring_file(argv[1], out);
+        std::cout.flush();
+    }
+    catch (std::exception& e) {
+        std::fprintf(stderr, "%s: %s\n", argv[0], e.what());
+        return 1;
+    }
+}